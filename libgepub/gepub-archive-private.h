@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) 2011  Daniel Garcia <danigm@wadobo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GEPUB_ARCHIVE_PRIVATE_H__
+#define __GEPUB_ARCHIVE_PRIVATE_H__
+
+#include "gepub-archive.h"
+
+// name, offset, compressed size, uncompressed size, method, flags, CRC-32
+#define GEPUB_ARCHIVE_INDEX_TYPE "a(stttqqu)"
+
+GVariant *_gepub_archive_save_index (GepubArchive *archive);
+gboolean  _gepub_archive_load_index (GepubArchive *archive, GVariant *saved);
+gsize     _gepub_archive_get_index_size (GepubArchive *archive);
+
+#endif
@@ -18,21 +18,97 @@
  */
 
 #include <config.h>
-#include <libxml/parser.h>
-#include <libxml/tree.h>
 #include <archive.h>
 #include <archive_entry.h>
+#include <string.h>
+#include <zlib.h>
 
 #include "gepub-archive.h"
+#include "gepub-archive-private.h"
 #include "gepub-utils.h"
+#include "gepub-trace-private.h"
 
 #define BUFZISE 1024
 
+/* ZIP record signatures and sizes, see the PKWARE APPNOTE */
+#define ZIP_LOCAL_HEADER_SIG      0x04034b50
+#define ZIP_CENTRAL_HEADER_SIG    0x02014b50
+#define ZIP_EOCD_SIG              0x06054b50
+#define ZIP64_EOCD_SIG            0x06064b50
+#define ZIP64_EOCD_LOCATOR_SIG    0x07064b50
+#define ZIP64_EXTRA_ID            0x0001
+
+#define ZIP_LOCAL_HEADER_SIZE     30
+#define ZIP_CENTRAL_HEADER_SIZE   46
+#define ZIP_EOCD_SIZE             22
+#define ZIP64_EOCD_SIZE           56
+#define ZIP64_EOCD_LOCATOR_SIZE   20
+#define ZIP_MAX_COMMENT           0xffff
+
+#define ZIP_METHOD_STORED         0
+#define ZIP_METHOD_DEFLATED       8
+
+#define ZIP_FLAG_ENCRYPTED        0x0001
+
+// deflate can't expand data by more than about 1032 times, bigger
+// sizes in the central directory are corrupt or hostile
+#define ZIP_MAX_DEFLATE_RATIO     1032
+
+/* Inflated entries are served from power of two sized buffers between
+ * 4KiB and 4MiB, keeping up to 8MiB of free ones for the next reads
+ * while there are archives alive.
+ */
+#define POOL_MIN_SHIFT            12
+#define POOL_MAX_SHIFT            22
+#define POOL_MAX_FREE_SIZE        (8 * 1024 * 1024)
+#define POOL_HEADER_SIZE          16
+
+typedef struct {
+    gchar *key;
+    GBytes *bytes;
+} GepubArchiveCacheItem;
+
+typedef struct {
+    gchar *name;
+    goffset offset;
+    guint64 compressed_size;
+    guint64 uncompressed_size;
+    guint16 method;
+    guint16 flags;
+    guint32 crc;
+} GepubArchiveEntry;
+
 struct _GepubArchive {
     GObject parent;
 
-    struct archive *archive;
     gchar *path;
+    GFile *file;
+
+    // the whole archive, mapped or given by the user
+    GBytes *data;
+
+    // reader handles, used when the archive isn't in memory. Each read
+    // takes one, so concurrent reads don't move each other's position
+    GMutex handles_lock;
+    GCond handles_cond;
+    GQueue handles;
+    guint n_handles;
+
+    // central directory, in archive order and by normalized path. It's
+    // built once on first use and never modified after that
+    gsize index_once;
+    GPtrArray *entries;
+    GHashTable *index;
+
+    // LRU cache of inflated entries, disabled while cache_max_size is 0.
+    // The table maps keys to links of the cache_lru queue
+    GMutex cache_lock;
+    GHashTable *cache;
+    GQueue cache_lru;
+    gsize cache_size;
+    gsize cache_max_size;
+    guint64 cache_hits;
+    guint64 cache_misses;
 };
 
 struct _GepubArchiveClass {
@@ -41,31 +117,938 @@ struct _GepubArchiveClass {
 
 G_DEFINE_TYPE (GepubArchive, gepub_archive, G_TYPE_OBJECT)
 
+G_LOCK_DEFINE_STATIC (buffer_pool);
+static gpointer buffer_pool[POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1];
+static gsize buffer_pool_free_size;
+static guint buffer_pool_n_archives;
+
+/* Every buffer carries a small header with its size class, 0 for the
+ * ones too big to be pooled. Free buffers are linked through their
+ * first bytes.
+ */
+static guchar *
+gepub_buffer_pool_acquire (gsize size)
+{
+    guint shift = POOL_MIN_SHIFT;
+    guchar *block = NULL;
+
+    while (shift <= POOL_MAX_SHIFT && ((gsize) 1 << shift) < size)
+        shift++;
+
+    if (shift > POOL_MAX_SHIFT) {
+        // the size comes from the archive, don't abort if it's absurd
+        if (size > G_MAXSIZE - POOL_HEADER_SIZE ||
+            !(block = g_try_malloc (POOL_HEADER_SIZE + size)))
+            return NULL;
+        *(guint *) block = 0;
+        return block + POOL_HEADER_SIZE;
+    }
+
+    G_LOCK (buffer_pool);
+    block = buffer_pool[shift - POOL_MIN_SHIFT];
+    if (block) {
+        buffer_pool[shift - POOL_MIN_SHIFT] = *(gpointer *) (block + POOL_HEADER_SIZE);
+        buffer_pool_free_size -= (gsize) 1 << shift;
+    }
+    G_UNLOCK (buffer_pool);
+
+    if (!block) {
+        block = g_malloc (POOL_HEADER_SIZE + ((gsize) 1 << shift));
+        *(guint *) block = shift;
+    }
+
+    return block + POOL_HEADER_SIZE;
+}
+
+static void
+gepub_buffer_pool_release (guchar *buffer)
+{
+    guchar *block = buffer - POOL_HEADER_SIZE;
+    guint shift = *(guint *) block;
+
+    if (shift) {
+        G_LOCK (buffer_pool);
+        if (buffer_pool_n_archives &&
+            buffer_pool_free_size + ((gsize) 1 << shift) <= POOL_MAX_FREE_SIZE) {
+            *(gpointer *) buffer = buffer_pool[shift - POOL_MIN_SHIFT];
+            buffer_pool[shift - POOL_MIN_SHIFT] = block;
+            buffer_pool_free_size += (gsize) 1 << shift;
+            block = NULL;
+        }
+        G_UNLOCK (buffer_pool);
+    }
+
+    g_free (block);
+}
+
+static void
+gepub_buffer_pool_add_archive (void)
+{
+    G_LOCK (buffer_pool);
+    buffer_pool_n_archives++;
+    G_UNLOCK (buffer_pool);
+}
+
+// frees the pooled buffers once the last archive is gone
+static void
+gepub_buffer_pool_remove_archive (void)
+{
+    gpointer free_blocks[POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1] = { NULL, };
+    guint i;
+
+    G_LOCK (buffer_pool);
+    if (!--buffer_pool_n_archives) {
+        memcpy (free_blocks, buffer_pool, sizeof (buffer_pool));
+        memset (buffer_pool, 0, sizeof (buffer_pool));
+        buffer_pool_free_size = 0;
+    }
+    G_UNLOCK (buffer_pool);
+
+    for (i = 0; i < G_N_ELEMENTS (free_blocks); i++) {
+        while (free_blocks[i]) {
+            guchar *block = free_blocks[i];
+
+            free_blocks[i] = *(gpointer *) (block + POOL_HEADER_SIZE);
+            g_free (block);
+        }
+    }
+}
+
+static GBytes *
+gepub_buffer_pool_bytes (guchar *buffer,
+                         gsize   size)
+{
+    return g_bytes_new_with_free_func (buffer, size,
+                                       (GDestroyNotify) gepub_buffer_pool_release,
+                                       buffer);
+}
+
+static inline guint16
+read_le16 (const guchar *p)
+{
+    return (guint16) (p[0] | (p[1] << 8));
+}
+
+static inline guint32
+read_le32 (const guchar *p)
+{
+    return (guint32) p[0] | ((guint32) p[1] << 8) |
+           ((guint32) p[2] << 16) | ((guint32) p[3] << 24);
+}
+
+static inline guint64
+read_le64 (const guchar *p)
+{
+    return (guint64) read_le32 (p) | ((guint64) read_le32 (p + 4) << 32);
+}
+
+static void
+gepub_archive_entry_free (GepubArchiveEntry *entry)
+{
+    g_free (entry->name);
+    g_free (entry);
+}
+
+/* Entries are looked up without the leading slash and ignoring the
+ * ASCII case, like the old sequential scan compared them.
+ */
+static gchar *
+gepub_archive_normalize_path (const gchar *path)
+{
+    while (path[0] == '/')
+        path++;
+
+    return g_ascii_strdown (path, -1);
+}
+
+static GInputStream *
+gepub_archive_open_handle (GepubArchive *archive)
+{
+    return G_INPUT_STREAM (g_file_read (archive->file, NULL, NULL));
+}
+
+/* Takes an idle reader handle, opening a new one if there are less
+ * than one per processor, or waits for one to be released. Archives
+ * read from a user stream have a single handle.
+ */
+static GInputStream *
+gepub_archive_acquire_handle (GepubArchive *archive)
+{
+    GInputStream *stream;
+    gboolean open_new = FALSE;
+
+    g_mutex_lock (&archive->handles_lock);
+    while (!(stream = g_queue_pop_head (&archive->handles))) {
+        if (archive->file && archive->n_handles < g_get_num_processors ()) {
+            archive->n_handles++;
+            open_new = TRUE;
+            break;
+        }
+        if (!archive->n_handles)
+            break;
+        g_cond_wait (&archive->handles_cond, &archive->handles_lock);
+    }
+    g_mutex_unlock (&archive->handles_lock);
+
+    if (open_new && !(stream = gepub_archive_open_handle (archive))) {
+        g_mutex_lock (&archive->handles_lock);
+        archive->n_handles--;
+        g_cond_signal (&archive->handles_cond);
+        g_mutex_unlock (&archive->handles_lock);
+    }
+
+    return stream;
+}
+
+static void
+gepub_archive_release_handle (GepubArchive *archive,
+                              GInputStream *stream)
+{
+    g_mutex_lock (&archive->handles_lock);
+    g_queue_push_head (&archive->handles, stream);
+    g_cond_signal (&archive->handles_cond);
+    g_mutex_unlock (&archive->handles_lock);
+}
+
+static void
+gepub_archive_cache_evict (GepubArchive *archive,
+                           gsize         max_size)
+{
+    while (archive->cache_size > max_size) {
+        GList *link = g_queue_pop_tail_link (&archive->cache_lru);
+        GepubArchiveCacheItem *item = link->data;
+
+        g_hash_table_remove (archive->cache, item->key);
+        archive->cache_size -= g_bytes_get_size (item->bytes);
+
+        g_bytes_unref (item->bytes);
+        g_free (item->key);
+        g_free (item);
+        g_list_free_1 (link);
+    }
+}
+
+static GBytes *
+gepub_archive_cache_lookup (GepubArchive *archive,
+                            const gchar  *key)
+{
+    GList *link;
+    GBytes *bytes = NULL;
+
+    g_mutex_lock (&archive->cache_lock);
+    if (archive->cache_max_size) {
+        link = g_hash_table_lookup (archive->cache, key);
+        if (link) {
+            g_queue_unlink (&archive->cache_lru, link);
+            g_queue_push_head_link (&archive->cache_lru, link);
+            bytes = g_bytes_ref (((GepubArchiveCacheItem *) link->data)->bytes);
+            archive->cache_hits++;
+        } else {
+            archive->cache_misses++;
+        }
+    }
+    g_mutex_unlock (&archive->cache_lock);
+
+    return bytes;
+}
+
+static void
+gepub_archive_cache_insert (GepubArchive *archive,
+                            const gchar  *key,
+                            GBytes       *bytes)
+{
+    GepubArchiveCacheItem *item;
+    gsize size = g_bytes_get_size (bytes);
+
+    g_mutex_lock (&archive->cache_lock);
+    if (archive->cache_max_size && size <= archive->cache_max_size &&
+        !g_hash_table_contains (archive->cache, key)) {
+        gepub_archive_cache_evict (archive, archive->cache_max_size - size);
+
+        item = g_new (GepubArchiveCacheItem, 1);
+        item->key = g_strdup (key);
+        item->bytes = g_bytes_ref (bytes);
+        g_queue_push_head (&archive->cache_lru, item);
+        g_hash_table_insert (archive->cache, item->key, archive->cache_lru.head);
+        archive->cache_size += size;
+    }
+    g_mutex_unlock (&archive->cache_lock);
+}
+
 static gboolean
 gepub_archive_open (GepubArchive *archive)
 {
-    int r;
+    GMappedFile *mapped;
+    GInputStream *stream;
 
-    archive->archive = archive_read_new ();
-    archive_read_support_format_zip (archive->archive);
+    if (archive->data || archive->n_handles)
+        return TRUE;
 
-    r = archive_read_open_filename (archive->archive, archive->path, 10240);
+    if (archive->path) {
+        mapped = g_mapped_file_new (archive->path, FALSE, NULL);
+        if (mapped) {
+            archive->data = g_mapped_file_get_bytes (mapped);
+            g_mapped_file_unref (mapped);
+            return TRUE;
+        }
+    }
 
-    if (r != ARCHIVE_OK) {
+    if (!archive->file)
+        return FALSE;
+
+    stream = gepub_archive_acquire_handle (archive);
+    if (!stream)
         return FALSE;
-    }
 
+    gepub_archive_release_handle (archive, stream);
     return TRUE;
 }
 
 static void
 gepub_archive_close (GepubArchive *archive)
 {
-    if (!archive->archive)
+    GInputStream *stream;
+
+    g_clear_pointer (&archive->data, g_bytes_unref);
+
+    while ((stream = g_queue_pop_head (&archive->handles)))
+        g_object_unref (stream);
+    archive->n_handles = 0;
+}
+
+static goffset
+gepub_archive_get_size (GepubArchive *archive)
+{
+    GInputStream *stream;
+    goffset size = -1;
+
+    if (archive->data)
+        return g_bytes_get_size (archive->data);
+
+    stream = gepub_archive_acquire_handle (archive);
+    if (!stream)
+        return -1;
+
+    if (g_seekable_seek (G_SEEKABLE (stream), 0, G_SEEK_END, NULL, NULL))
+        size = g_seekable_tell (G_SEEKABLE (stream));
+
+    gepub_archive_release_handle (archive, stream);
+
+    return size;
+}
+
+static gboolean
+gepub_archive_read_at (GepubArchive *archive,
+                       goffset       offset,
+                       gpointer      buffer,
+                       gsize         size)
+{
+    GInputStream *stream;
+    gsize bytes_read = 0;
+    gboolean ret;
+
+    if (archive->data) {
+        gsize data_size;
+        const guchar *data = g_bytes_get_data (archive->data, &data_size);
+
+        if (offset < 0 || (guint64) offset > data_size || size > data_size - offset)
+            return FALSE;
+
+        memcpy (buffer, data + offset, size);
+        return TRUE;
+    }
+
+    stream = gepub_archive_acquire_handle (archive);
+    if (!stream)
+        return FALSE;
+
+    ret = g_seekable_seek (G_SEEKABLE (stream), offset, G_SEEK_SET, NULL, NULL) &&
+          g_input_stream_read_all (stream, buffer, size, &bytes_read, NULL, NULL) &&
+          bytes_read == size;
+
+    gepub_archive_release_handle (archive, stream);
+
+    return ret;
+}
+
+/* Returns @size bytes at @offset. Mapped archives return a slice of
+ * the mapping, without copying anything.
+ */
+static GBytes *
+gepub_archive_read_range (GepubArchive *archive,
+                          goffset       offset,
+                          gsize         size)
+{
+    guchar *buffer;
+
+    if (archive->data) {
+        gsize data_size = g_bytes_get_size (archive->data);
+
+        if (offset < 0 || (guint64) offset > data_size || size > data_size - offset)
+            return NULL;
+
+        return g_bytes_new_from_bytes (archive->data, offset, size);
+    }
+
+    buffer = gepub_buffer_pool_acquire (size);
+    if (!buffer)
+        return NULL;
+
+    if (!gepub_archive_read_at (archive, offset, buffer, size)) {
+        gepub_buffer_pool_release (buffer);
+        return NULL;
+    }
+
+    return gepub_buffer_pool_bytes (buffer, size);
+}
+
+/* Looks for the end of central directory record, following the zip64
+ * locator when there is one.
+ */
+static gboolean
+gepub_archive_find_central_directory (GepubArchive *archive,
+                                      goffset      *cd_offset,
+                                      guint64      *cd_size,
+                                      guint64      *n_entries)
+{
+    goffset file_size;
+    gsize tail_size;
+    gssize i, eocd_pos = -1;
+    GBytes *tail_bytes;
+    const guchar *tail, *eocd;
+    gboolean ret;
+
+    file_size = gepub_archive_get_size (archive);
+    if (file_size < ZIP_EOCD_SIZE)
+        return FALSE;
+
+    tail_size = MIN (file_size, ZIP64_EOCD_LOCATOR_SIZE + ZIP_EOCD_SIZE + ZIP_MAX_COMMENT);
+    tail_bytes = gepub_archive_read_range (archive, file_size - tail_size, tail_size);
+    if (!tail_bytes)
+        return FALSE;
+    tail = g_bytes_get_data (tail_bytes, NULL);
+
+    for (i = tail_size - ZIP_EOCD_SIZE; i >= 0; i--) {
+        if (read_le32 (tail + i) == ZIP_EOCD_SIG) {
+            eocd_pos = i;
+            break;
+        }
+    }
+
+    if (eocd_pos < 0) {
+        g_bytes_unref (tail_bytes);
+        return FALSE;
+    }
+
+    eocd = tail + eocd_pos;
+    *n_entries = read_le16 (eocd + 10);
+    *cd_size = read_le32 (eocd + 12);
+    *cd_offset = read_le32 (eocd + 16);
+
+    if (eocd_pos >= ZIP64_EOCD_LOCATOR_SIZE &&
+        read_le32 (eocd - ZIP64_EOCD_LOCATOR_SIZE) == ZIP64_EOCD_LOCATOR_SIG) {
+        guchar eocd64[ZIP64_EOCD_SIZE];
+        goffset eocd64_offset = read_le64 (eocd - ZIP64_EOCD_LOCATOR_SIZE + 8);
+
+        if (gepub_archive_read_at (archive, eocd64_offset, eocd64, ZIP64_EOCD_SIZE) &&
+            read_le32 (eocd64) == ZIP64_EOCD_SIG) {
+            *n_entries = read_le64 (eocd64 + 32);
+            *cd_size = read_le64 (eocd64 + 40);
+            *cd_offset = read_le64 (eocd64 + 48);
+        }
+    }
+
+    ret = *cd_offset >= 0 && *cd_size <= (guint64) (file_size - *cd_offset);
+    g_bytes_unref (tail_bytes);
+
+    return ret;
+}
+
+/* Values saturated in the central directory header are stored in the
+ * zip64 extra field, in this order and only when they're saturated.
+ */
+static void
+gepub_archive_parse_zip64_extra (GepubArchiveEntry *entry,
+                                 const guchar      *extra,
+                                 gsize              extra_len,
+                                 gboolean           usize,
+                                 gboolean           csize,
+                                 gboolean           offset)
+{
+    while (extra_len >= 4) {
+        guint16 id = read_le16 (extra);
+        gsize len = read_le16 (extra + 2);
+        const guchar *data = extra + 4;
+
+        if (len > extra_len - 4)
+            return;
+
+        if (id == ZIP64_EXTRA_ID) {
+            if (usize && len >= 8) {
+                entry->uncompressed_size = read_le64 (data);
+                data += 8;
+                len -= 8;
+            }
+            if (csize && len >= 8) {
+                entry->compressed_size = read_le64 (data);
+                data += 8;
+                len -= 8;
+            }
+            if (offset && len >= 8)
+                entry->offset = read_le64 (data);
+            return;
+        }
+
+        extra += 4 + len;
+        extra_len -= 4 + len;
+    }
+}
+
+static void
+gepub_archive_add_entry (GepubArchive      *archive,
+                         GepubArchiveEntry *entry)
+{
+    gchar *key;
+
+    g_ptr_array_add (archive->entries, entry);
+
+    // like the sequential scan, the first entry with a name wins
+    key = gepub_archive_normalize_path (entry->name);
+    if (!g_hash_table_contains (archive->index, key))
+        g_hash_table_insert (archive->index, key, entry);
+    else
+        g_free (key);
+}
+
+/* Reads the whole central directory once and indexes every entry by
+ * its normalized path. If the archive can't be indexed the reads fall
+ * back to the libarchive sequential scan.
+ */
+static gboolean
+gepub_archive_build_index (GepubArchive *archive,
+                           guint64      *cd_read)
+{
+    goffset cd_offset;
+    guint64 cd_size, n_entries, i;
+    GBytes *cd;
+    const guchar *p, *end;
+
+    if (!gepub_archive_open (archive))
+        return FALSE;
+
+    if (!gepub_archive_find_central_directory (archive, &cd_offset, &cd_size, &n_entries))
+        return FALSE;
+
+    cd = gepub_archive_read_range (archive, cd_offset, cd_size);
+    if (!cd)
+        return FALSE;
+    *cd_read = cd_size;
+
+    archive->entries = g_ptr_array_new_with_free_func ((GDestroyNotify) gepub_archive_entry_free);
+    archive->index = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+    p = g_bytes_get_data (cd, NULL);
+    end = p + cd_size;
+    for (i = 0; i < n_entries && end - p >= ZIP_CENTRAL_HEADER_SIZE; i++) {
+        GepubArchiveEntry *entry;
+        guint32 csize, usize, offset;
+        gsize name_len, extra_len, comment_len;
+
+        if (read_le32 (p) != ZIP_CENTRAL_HEADER_SIG)
+            break;
+
+        name_len = read_le16 (p + 28);
+        extra_len = read_le16 (p + 30);
+        comment_len = read_le16 (p + 32);
+        if ((gsize) (end - p) < ZIP_CENTRAL_HEADER_SIZE + name_len + extra_len + comment_len)
+            break;
+
+        csize = read_le32 (p + 20);
+        usize = read_le32 (p + 24);
+        offset = read_le32 (p + 42);
+
+        entry = g_new0 (GepubArchiveEntry, 1);
+        entry->flags = read_le16 (p + 8);
+        entry->crc = read_le32 (p + 16);
+        entry->method = read_le16 (p + 10);
+        entry->compressed_size = csize;
+        entry->uncompressed_size = usize;
+        entry->offset = offset;
+        entry->name = g_strndup ((const gchar *) p + ZIP_CENTRAL_HEADER_SIZE, name_len);
+
+        if (csize == G_MAXUINT32 || usize == G_MAXUINT32 || offset == G_MAXUINT32) {
+            gepub_archive_parse_zip64_extra (entry,
+                                             p + ZIP_CENTRAL_HEADER_SIZE + name_len,
+                                             extra_len,
+                                             usize == G_MAXUINT32,
+                                             csize == G_MAXUINT32,
+                                             offset == G_MAXUINT32);
+        }
+
+        gepub_archive_add_entry (archive, entry);
+
+        p += ZIP_CENTRAL_HEADER_SIZE + name_len + extra_len + comment_len;
+    }
+
+    g_bytes_unref (cd);
+
+    if (i != n_entries) {
+        g_clear_pointer (&archive->index, g_hash_table_destroy);
+        g_clear_pointer (&archive->entries, g_ptr_array_unref);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+gepub_archive_ensure_index (GepubArchive *archive)
+{
+    if (g_once_init_enter (&archive->index_once)) {
+        gint64 begin = _gepub_trace_begin ();
+        guint64 cd_read = 0;
+
+        gepub_archive_build_index (archive, &cd_read);
+        _gepub_trace_end (GEPUB_TRACE_ARCHIVE_OPEN, begin, archive->path, cd_read,
+                          archive->entries ? archive->entries->len * sizeof (GepubArchiveEntry) : 0);
+        g_once_init_leave (&archive->index_once, 1);
+    }
+
+    return archive->index != NULL;
+}
+
+static gboolean
+gepub_archive_inflate (const guchar *in,
+                       gsize         in_size,
+                       guchar       *out,
+                       gsize         out_size)
+{
+    GConverter *decompressor;
+    GConverterResult res;
+    gsize total_read = 0, total_written = 0;
+
+    decompressor = G_CONVERTER (g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_RAW));
+
+    do {
+        gsize bytes_read = 0, bytes_written = 0;
+
+        res = g_converter_convert (decompressor,
+                                   in + total_read, in_size - total_read,
+                                   out + total_written, out_size - total_written,
+                                   G_CONVERTER_INPUT_AT_END,
+                                   &bytes_read, &bytes_written, NULL);
+        total_read += bytes_read;
+        total_written += bytes_written;
+
+        if (res == G_CONVERTER_CONVERTED && !bytes_read && !bytes_written)
+            res = G_CONVERTER_ERROR;
+    } while (res == G_CONVERTER_CONVERTED);
+
+    g_object_unref (decompressor);
+
+    return res == G_CONVERTER_FINISHED && total_written == out_size;
+}
+
+static gboolean
+gepub_archive_entry_is_supported (GepubArchiveEntry *entry)
+{
+    if (entry->flags & ZIP_FLAG_ENCRYPTED)
+        return FALSE;
+
+    if (entry->uncompressed_size > G_MAXSIZE || entry->compressed_size > G_MAXSIZE)
+        return FALSE;
+
+    return entry->method == ZIP_METHOD_STORED || entry->method == ZIP_METHOD_DEFLATED;
+}
+
+static GepubArchiveEntry *
+gepub_archive_lookup (GepubArchive *archive,
+                      const gchar  *path)
+{
+    GepubArchiveEntry *entry;
+    gchar *key;
+
+    key = gepub_archive_normalize_path (path);
+    entry = g_hash_table_lookup (archive->index, key);
+    g_free (key);
+
+    return entry;
+}
+
+/* Stored entries of archives in memory are free to read, there's no
+ * point in keeping them in the cache.
+ */
+static gboolean
+gepub_archive_entry_is_cacheable (GepubArchive      *archive,
+                                  GepubArchiveEntry *entry)
+{
+    return !(archive->data && entry->method == ZIP_METHOD_STORED &&
+             gepub_archive_entry_is_supported (entry));
+}
+
+/* Returns the offset of the entry data, -1 if the local header is
+ * broken.
+ */
+static goffset
+gepub_archive_entry_data_offset (GepubArchive      *archive,
+                                 GepubArchiveEntry *entry)
+{
+    guchar header[ZIP_LOCAL_HEADER_SIZE];
+
+    if (!gepub_archive_read_at (archive, entry->offset, header, ZIP_LOCAL_HEADER_SIZE) ||
+        read_le32 (header) != ZIP_LOCAL_HEADER_SIG)
+        return -1;
+
+    // the local extra field can differ from the central directory one
+    return entry->offset + ZIP_LOCAL_HEADER_SIZE +
+           read_le16 (header + 26) + read_le16 (header + 28);
+}
+
+static GBytes *gepub_archive_read_scan (GepubArchive *archive,
+                                        const gchar  *path);
+
+static gboolean
+gepub_archive_check_crc (GepubArchiveEntry *entry,
+                         GBytes            *bytes)
+{
+    gsize size;
+    const guchar *data = g_bytes_get_data (bytes, &size);
+    uLong crc = crc32 (0L, Z_NULL, 0);
+
+    while (size) {
+        uInt chunk = MIN (size, G_MAXUINT);
+
+        crc = crc32 (crc, data, chunk);
+        data += chunk;
+        size -= chunk;
+    }
+
+    return crc == entry->crc;
+}
+
+/* Reads an entry through the index. Entries whose local header can't be
+ * found, like in archives with data prepended, or that don't inflate,
+ * are read again with the libarchive scan. Entries with impossible sizes
+ * or a wrong CRC are corrupt and aren't returned at all.
+ */
+static GBytes *
+gepub_archive_read_indexed (GepubArchive      *archive,
+                            GepubArchiveEntry *entry)
+{
+    goffset data_offset;
+    GBytes *compressed;
+    const guchar *in;
+    guchar *buffer;
+    gsize size = entry->uncompressed_size;
+    gint64 begin = _gepub_trace_begin ();
+    GBytes *bytes;
+
+    if (entry->method == ZIP_METHOD_STORED ?
+        entry->uncompressed_size != entry->compressed_size :
+        entry->uncompressed_size / ZIP_MAX_DEFLATE_RATIO > entry->compressed_size)
+        return NULL;
+
+    data_offset = gepub_archive_entry_data_offset (archive, entry);
+    if (data_offset < 0)
+        return gepub_archive_read_scan (archive, entry->name);
+
+    if (entry->method == ZIP_METHOD_STORED) {
+        bytes = gepub_archive_read_range (archive, data_offset, size);
+        if (!bytes)
+            return gepub_archive_read_scan (archive, entry->name);
+    } else {
+        compressed = gepub_archive_read_range (archive, data_offset, entry->compressed_size);
+        if (!compressed)
+            return gepub_archive_read_scan (archive, entry->name);
+
+        buffer = gepub_buffer_pool_acquire (size);
+        if (!buffer) {
+            g_bytes_unref (compressed);
+            return NULL;
+        }
+
+        in = g_bytes_get_data (compressed, NULL);
+        if (size && !gepub_archive_inflate (in, entry->compressed_size, buffer, size)) {
+            gepub_buffer_pool_release (buffer);
+            g_bytes_unref (compressed);
+            return gepub_archive_read_scan (archive, entry->name);
+        }
+
+        g_bytes_unref (compressed);
+        bytes = gepub_buffer_pool_bytes (buffer, size);
+    }
+
+    if (!gepub_archive_check_crc (entry, bytes)) {
+        g_bytes_unref (bytes);
+        return NULL;
+    }
+
+    _gepub_trace_end (GEPUB_TRACE_ENTRY_READ, begin, entry->name, entry->compressed_size, size);
+
+    return bytes;
+}
+
+typedef struct {
+    GepubArchive *archive;
+    GInputStream *stream;
+    guchar buffer[BUFZISE * 10];
+} GepubArchiveScanData;
+
+static la_ssize_t
+gepub_archive_scan_read (struct archive *a,
+                         void           *client_data,
+                         const void    **buffer)
+{
+    GepubArchiveScanData *data = client_data;
+    gssize n;
+
+    n = g_input_stream_read (data->stream, data->buffer, sizeof (data->buffer), NULL, NULL);
+    *buffer = data->buffer;
+
+    return n < 0 ? -1 : n;
+}
+
+static int
+gepub_archive_scan_close (struct archive *a,
+                          void           *client_data)
+{
+    GepubArchiveScanData *data = client_data;
+
+    gepub_archive_release_handle (data->archive, data->stream);
+    g_free (data);
+
+    return ARCHIVE_OK;
+}
+
+/* Opens a libarchive reader over the archive source, for the
+ * sequential scan slow path.
+ */
+static struct archive *
+gepub_archive_scan_open (GepubArchive *archive)
+{
+    struct archive *a;
+    int r;
+
+    a = archive_read_new ();
+    archive_read_support_format_zip (a);
+
+    if (archive->data) {
+        r = archive_read_open_memory (a, (void *) g_bytes_get_data (archive->data, NULL),
+                                      g_bytes_get_size (archive->data));
+    } else if (archive->path) {
+        r = archive_read_open_filename (a, archive->path, 10240);
+    } else {
+        GepubArchiveScanData *data;
+        GInputStream *stream = gepub_archive_acquire_handle (archive);
+
+        if (!stream)
+            r = ARCHIVE_FATAL;
+        else if (!g_seekable_seek (G_SEEKABLE (stream), 0, G_SEEK_SET, NULL, NULL)) {
+            gepub_archive_release_handle (archive, stream);
+            r = ARCHIVE_FATAL;
+        } else {
+            data = g_new0 (GepubArchiveScanData, 1);
+            data->archive = archive;
+            data->stream = stream;
+            r = archive_read_open (a, data, NULL,
+                                   gepub_archive_scan_read,
+                                   gepub_archive_scan_close);
+        }
+    }
+
+    if (r != ARCHIVE_OK) {
+        archive_read_free (a);
+        return NULL;
+    }
+
+    return a;
+}
+
+/* Slow path for archives that can't be indexed or entries using a
+ * compression method we don't inflate ourselves.
+ */
+static GBytes *
+gepub_archive_read_scan (GepubArchive *archive,
+                         const gchar  *path)
+{
+    struct archive *a;
+    struct archive_entry *entry;
+    guchar *buffer;
+    gint size;
+    gboolean found = FALSE;
+    gint64 begin = _gepub_trace_begin ();
+
+    a = gepub_archive_scan_open (archive);
+    if (!a)
+        return NULL;
+
+    while (archive_read_next_header (a, &entry) == ARCHIVE_OK) {
+        if (g_ascii_strcasecmp (path, archive_entry_pathname (entry)) == 0) {
+            found = TRUE;
+            break;
+        }
+        archive_read_data_skip (a);
+    }
+
+    if (!found) {
+        archive_read_free (a);
+        return NULL;
+    }
+
+    size = archive_entry_size (entry);
+    buffer = size >= 0 ? g_try_malloc (MAX (size, 1)) : NULL;
+    // libarchive checks the CRC, a short read is a corrupt entry
+    if (!buffer || archive_read_data (a, buffer, size) != size) {
+        g_free (buffer);
+        archive_read_free (a);
+        return NULL;
+    }
+
+    archive_read_free (a);
+    _gepub_trace_end (GEPUB_TRACE_ENTRY_READ, begin, path, size, size);
+
+    return g_bytes_new_take (buffer, size);
+}
+
+/* Reads every entry in @keys in a single libarchive pass, @keys maps
+ * the normalized paths to their position in @result plus one.
+ */
+static void
+gepub_archive_read_scan_many (GepubArchive *archive,
+                              GHashTable   *keys,
+                              GPtrArray    *result)
+{
+    struct archive *a;
+    struct archive_entry *entry;
+    guint pending = g_hash_table_size (keys);
+
+    a = gepub_archive_scan_open (archive);
+    if (!a)
         return;
 
-    archive_read_free (archive->archive);
-    archive->archive = NULL;
+    while (pending && archive_read_next_header (a, &entry) == ARCHIVE_OK) {
+        g_autofree gchar *key = gepub_archive_normalize_path (archive_entry_pathname (entry));
+        guint pos = GPOINTER_TO_UINT (g_hash_table_lookup (keys, key));
+        guchar *buffer;
+        gint size;
+
+        if (!pos || g_ptr_array_index (result, pos - 1)) {
+            archive_read_data_skip (a);
+            continue;
+        }
+
+        size = archive_entry_size (entry);
+        buffer = size >= 0 ? g_try_malloc (MAX (size, 1)) : NULL;
+        if (!buffer || archive_read_data (a, buffer, size) != size) {
+            g_free (buffer);
+            archive_read_data_skip (a);
+            continue;
+        }
+        g_ptr_array_index (result, pos - 1) = g_bytes_new_take (buffer, size);
+        pending--;
+    }
+
+    archive_read_free (a);
 }
 
 static void
@@ -74,8 +1057,20 @@ gepub_archive_finalize (GObject *object)
     GepubArchive *archive = GEPUB_ARCHIVE (object);
 
     g_clear_pointer (&archive->path, g_free);
+    g_clear_object (&archive->file);
+    g_clear_pointer (&archive->index, g_hash_table_destroy);
+    g_clear_pointer (&archive->entries, g_ptr_array_unref);
+
+    gepub_archive_close (archive);
+
+    gepub_archive_cache_evict (archive, 0);
+    g_clear_pointer (&archive->cache, g_hash_table_destroy);
+
+    g_mutex_clear (&archive->handles_lock);
+    g_cond_clear (&archive->handles_cond);
+    g_mutex_clear (&archive->cache_lock);
 
-    gepub_archive_close (archive);
+    gepub_buffer_pool_remove_archive ();
 
     G_OBJECT_CLASS (gepub_archive_parent_class)->finalize (object);
 }
@@ -83,6 +1078,15 @@ gepub_archive_finalize (GObject *object)
 static void
 gepub_archive_init (GepubArchive *archive)
 {
+    g_mutex_init (&archive->handles_lock);
+    g_cond_init (&archive->handles_cond);
+    g_queue_init (&archive->handles);
+
+    g_mutex_init (&archive->cache_lock);
+    g_queue_init (&archive->cache_lru);
+    archive->cache = g_hash_table_new (g_str_hash, g_str_equal);
+
+    gepub_buffer_pool_add_archive ();
 }
 
 static void
@@ -93,6 +1097,14 @@ gepub_archive_class_init (GepubArchiveClass *klass)
     object_class->finalize = gepub_archive_finalize;
 }
 
+/**
+ * gepub_archive_new:
+ * @path: the epub file path
+ *
+ * The returned archive can be read from several threads at once.
+ *
+ * Returns: (transfer full): the new #GepubArchive
+ */
 GepubArchive *
 gepub_archive_new (const gchar *path)
 {
@@ -100,7 +1112,76 @@ gepub_archive_new (const gchar *path)
 
     archive = GEPUB_ARCHIVE (g_object_new (GEPUB_TYPE_ARCHIVE, NULL));
     archive->path = g_strdup (path);
-    archive->archive = NULL;
+    archive->file = g_file_new_for_path (path);
+    archive->data = NULL;
+
+    return archive;
+}
+
+/**
+ * gepub_archive_new_from_file:
+ * @file: a #GFile
+ *
+ * Local files are memory mapped, other files are read through GIO.
+ *
+ * Returns: (transfer full): the new #GepubArchive
+ */
+GepubArchive *
+gepub_archive_new_from_file (GFile *file)
+{
+    GepubArchive *archive;
+
+    g_return_val_if_fail (G_IS_FILE (file), NULL);
+
+    archive = GEPUB_ARCHIVE (g_object_new (GEPUB_TYPE_ARCHIVE, NULL));
+    archive->path = g_file_get_path (file);
+    archive->file = g_object_ref (file);
+
+    return archive;
+}
+
+/**
+ * gepub_archive_new_from_bytes:
+ * @bytes: the epub file content
+ *
+ * Stored entries are returned as slices of @bytes, without copies.
+ *
+ * Returns: (transfer full): the new #GepubArchive
+ */
+GepubArchive *
+gepub_archive_new_from_bytes (GBytes *bytes)
+{
+    GepubArchive *archive;
+
+    g_return_val_if_fail (bytes != NULL, NULL);
+
+    archive = GEPUB_ARCHIVE (g_object_new (GEPUB_TYPE_ARCHIVE, NULL));
+    archive->data = g_bytes_ref (bytes);
+
+    return archive;
+}
+
+/**
+ * gepub_archive_new_from_stream:
+ * @stream: a seekable #GInputStream with the epub file content
+ *
+ * The archive takes ownership of the stream position, it shouldn't be
+ * read by anybody else while the archive is alive.
+ *
+ * Returns: (transfer full): the new #GepubArchive
+ */
+GepubArchive *
+gepub_archive_new_from_stream (GInputStream *stream)
+{
+    GepubArchive *archive;
+
+    g_return_val_if_fail (G_IS_INPUT_STREAM (stream), NULL);
+    g_return_val_if_fail (G_IS_SEEKABLE (stream) &&
+                          g_seekable_can_seek (G_SEEKABLE (stream)), NULL);
+
+    archive = GEPUB_ARCHIVE (g_object_new (GEPUB_TYPE_ARCHIVE, NULL));
+    g_queue_push_head (&archive->handles, g_object_ref (stream));
+    archive->n_handles = 1;
 
     return archive;
 }
@@ -114,27 +1195,49 @@ gepub_archive_new (const gchar *path)
 GList *
 gepub_archive_list_files (GepubArchive *archive)
 {
+    struct archive *a;
     struct archive_entry *entry;
     GList *file_list = NULL;
+    guint i;
 
-    if (!gepub_archive_open (archive))
+    if (gepub_archive_ensure_index (archive)) {
+        for (i = 0; i < archive->entries->len; i++) {
+            GepubArchiveEntry *e = g_ptr_array_index (archive->entries, i);
+            file_list = g_list_prepend (file_list, g_strdup (e->name));
+        }
+        return file_list;
+    }
+
+    a = gepub_archive_scan_open (archive);
+    if (!a)
         return NULL;
-    while (archive_read_next_header (archive->archive, &entry) == ARCHIVE_OK) {
+
+    while (archive_read_next_header (a, &entry) == ARCHIVE_OK) {
         file_list = g_list_prepend (file_list, g_strdup (archive_entry_pathname (entry)));
-        archive_read_data_skip (archive->archive);
+        archive_read_data_skip (a);
     }
-    gepub_archive_close (archive);
+    archive_read_free (a);
 
     return file_list;
 }
 
+/**
+ * gepub_archive_read_entry:
+ * @archive: a #GepubArchive
+ * @path: the entry path
+ *
+ * Stored entries of a memory mapped archive are returned as slices of
+ * the mapping, so the returned bytes can outlive @archive.
+ *
+ * Returns: (transfer full): the entry content, or %NULL if it doesn't exist
+ */
 GBytes *
 gepub_archive_read_entry (GepubArchive *archive,
                           const gchar *path)
 {
-    struct archive_entry *entry;
-    guchar *buffer;
-    gint size;
+    GepubArchiveEntry *entry = NULL;
+    GBytes *bytes;
+    g_autofree gchar *key = NULL;
     const gchar *_path;
 
     if (path[0] == '/') {
@@ -144,32 +1247,556 @@ gepub_archive_read_entry (GepubArchive *archive,
         _path = path;
     }
 
-    if (!gepub_archive_open (archive))
+    key = gepub_archive_normalize_path (_path);
+
+    if (gepub_archive_ensure_index (archive)) {
+        entry = g_hash_table_lookup (archive->index, key);
+        if (!entry)
+            return NULL;
+
+        if (!gepub_archive_entry_is_cacheable (archive, entry))
+            return gepub_archive_read_indexed (archive, entry);
+    }
+
+    bytes = gepub_archive_cache_lookup (archive, key);
+    if (bytes)
+        return bytes;
+
+    if (!entry)
+        bytes = gepub_archive_read_scan (archive, _path);
+    else if (!gepub_archive_entry_is_supported (entry))
+        bytes = gepub_archive_read_scan (archive, entry->name);
+    else
+        bytes = gepub_archive_read_indexed (archive, entry);
+
+    if (bytes)
+        gepub_archive_cache_insert (archive, key, bytes);
+
+    return bytes;
+}
+
+static void
+gepub_archive_read_entry_thread (GTask        *task,
+                                 gpointer      source_object,
+                                 gpointer      task_data,
+                                 GCancellable *cancellable)
+{
+    GepubArchive *archive = source_object;
+    const gchar *path = task_data;
+    GBytes *bytes;
+
+    if (g_task_return_error_if_cancelled (task))
+        return;
+
+    bytes = gepub_archive_read_entry (archive, path);
+    if (!bytes) {
+        g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                                 "No entry %s in the archive", path);
+        return;
+    }
+
+    g_task_return_pointer (task, bytes, (GDestroyNotify) g_bytes_unref);
+}
+
+/**
+ * gepub_archive_read_entry_async:
+ * @archive: a #GepubArchive
+ * @path: the entry path
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: a #GAsyncReadyCallback to call when the entry is read
+ * @user_data: the data to pass to @callback
+ *
+ * Reads the entry in a worker thread. See gepub_archive_read_entry().
+ */
+void
+gepub_archive_read_entry_async (GepubArchive        *archive,
+                                const gchar         *path,
+                                GCancellable        *cancellable,
+                                GAsyncReadyCallback  callback,
+                                gpointer             user_data)
+{
+    GTask *task;
+
+    g_return_if_fail (GEPUB_IS_ARCHIVE (archive));
+    g_return_if_fail (path != NULL);
+
+    task = g_task_new (archive, cancellable, callback, user_data);
+    g_task_set_source_tag (task, gepub_archive_read_entry_async);
+    g_task_set_task_data (task, g_strdup (path), g_free);
+    g_task_run_in_thread (task, gepub_archive_read_entry_thread);
+    g_object_unref (task);
+}
+
+/**
+ * gepub_archive_read_entry_finish:
+ * @archive: a #GepubArchive
+ * @result: the #GAsyncResult passed to the callback
+ * @error: (nullable): Error
+ *
+ * Returns: (transfer full): the entry content, or %NULL on error
+ */
+GBytes *
+gepub_archive_read_entry_finish (GepubArchive  *archive,
+                                 GAsyncResult  *result,
+                                 GError       **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, archive), NULL);
+
+    return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static void
+gepub_archive_bytes_unref (GBytes *bytes)
+{
+    if (bytes)
+        g_bytes_unref (bytes);
+}
+
+static gint
+gepub_archive_entry_offset_compare (gconstpointer a,
+                                    gconstpointer b)
+{
+    const GepubArchiveEntry *ea = *(GepubArchiveEntry * const *) a;
+    const GepubArchiveEntry *eb = *(GepubArchiveEntry * const *) b;
+
+    return (ea->offset > eb->offset) - (ea->offset < eb->offset);
+}
+
+/**
+ * gepub_archive_read_entries:
+ * @archive: a #GepubArchive
+ * @paths: (array zero-terminated=1): the entry paths
+ *
+ * Reads several entries at once. The entries are read in the order
+ * they're stored in the archive, so the archive is swept only once.
+ *
+ * Returns: (transfer full) (element-type GBytes): the content of every
+ * entry, in the same order as @paths and %NULL for the missing ones
+ */
+GPtrArray *
+gepub_archive_read_entries (GepubArchive       *archive,
+                            const gchar * const *paths)
+{
+    GPtrArray *result;
+    GHashTable *keys;
+    guint i, n;
+
+    g_return_val_if_fail (GEPUB_IS_ARCHIVE (archive), NULL);
+    g_return_val_if_fail (paths != NULL, NULL);
+
+    n = g_strv_length ((gchar **) paths);
+    result = g_ptr_array_new_full (n, (GDestroyNotify) gepub_archive_bytes_unref);
+    g_ptr_array_set_size (result, n);
+
+    // the first position of every requested entry, plus one
+    keys = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    for (i = 0; i < n; i++) {
+        gchar *key = gepub_archive_normalize_path (paths[i]);
+
+        if (!g_hash_table_contains (keys, key))
+            g_hash_table_insert (keys, key, GUINT_TO_POINTER (i + 1));
+        else
+            g_free (key);
+    }
+
+    if (gepub_archive_ensure_index (archive)) {
+        GHashTableIter iter;
+        gpointer key, value;
+        GPtrArray *entries = g_ptr_array_new ();
+        GHashTable *positions = g_hash_table_new (NULL, NULL);
+
+        g_hash_table_iter_init (&iter, keys);
+        while (g_hash_table_iter_next (&iter, &key, &value)) {
+            GepubArchiveEntry *entry = g_hash_table_lookup (archive->index, key);
+
+            if (entry) {
+                g_ptr_array_add (entries, entry);
+                g_hash_table_insert (positions, entry, value);
+            }
+        }
+
+        g_ptr_array_sort (entries, gepub_archive_entry_offset_compare);
+
+        for (i = 0; i < entries->len; i++) {
+            GepubArchiveEntry *entry = g_ptr_array_index (entries, i);
+            guint pos = GPOINTER_TO_UINT (g_hash_table_lookup (positions, entry));
+
+            g_ptr_array_index (result, pos - 1) = gepub_archive_read_entry (archive, entry->name);
+        }
+
+        g_hash_table_destroy (positions);
+        g_ptr_array_unref (entries);
+    } else {
+        gepub_archive_read_scan_many (archive, keys, result);
+    }
+
+    // repeated paths share the bytes read for the first one
+    for (i = 0; i < n; i++) {
+        g_autofree gchar *key = NULL;
+        guint pos;
+
+        if (g_ptr_array_index (result, i))
+            continue;
+
+        key = gepub_archive_normalize_path (paths[i]);
+        pos = GPOINTER_TO_UINT (g_hash_table_lookup (keys, key));
+        if (pos - 1 != i && g_ptr_array_index (result, pos - 1))
+            g_ptr_array_index (result, i) = g_bytes_ref (g_ptr_array_index (result, pos - 1));
+    }
+
+    g_hash_table_destroy (keys);
+
+    return result;
+}
+
+/* Reads a range of the archive file through the reader handles, taking
+ * one only for each read, so an open stream never holds a handle other
+ * reads could be waiting for.
+ */
+typedef struct {
+    GInputStream parent;
+
+    GepubArchive *archive;
+    goffset offset;             // next position to read in the archive
+    guint64 remaining;
+} GepubArchiveRangeStream;
+
+typedef struct {
+    GInputStreamClass parent_class;
+} GepubArchiveRangeStreamClass;
+
+static GType gepub_archive_range_stream_get_type (void);
+
+G_DEFINE_TYPE (GepubArchiveRangeStream, gepub_archive_range_stream, G_TYPE_INPUT_STREAM)
+
+static gssize
+gepub_archive_range_stream_read (GInputStream  *input,
+                                 void          *buffer,
+                                 gsize          count,
+                                 GCancellable  *cancellable,
+                                 GError       **error)
+{
+    GepubArchiveRangeStream *range = (GepubArchiveRangeStream *) input;
+    GInputStream *handle;
+    gssize n;
+
+    if (!range->remaining)
+        return 0;
+
+    count = MIN (count, range->remaining);
+
+    handle = gepub_archive_acquire_handle (range->archive);
+    if (!handle) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Can't read the archive");
+        return -1;
+    }
+
+    if (g_seekable_seek (G_SEEKABLE (handle), range->offset, G_SEEK_SET, cancellable, error))
+        n = g_input_stream_read (handle, buffer, count, cancellable, error);
+    else
+        n = -1;
+
+    gepub_archive_release_handle (range->archive, handle);
+
+    if (n == 0) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT, "Truncated archive entry");
+        return -1;
+    }
+
+    if (n > 0) {
+        range->offset += n;
+        range->remaining -= n;
+    }
+
+    return n;
+}
+
+static void
+gepub_archive_range_stream_finalize (GObject *object)
+{
+    GepubArchiveRangeStream *range = (GepubArchiveRangeStream *) object;
+
+    g_clear_object (&range->archive);
+
+    G_OBJECT_CLASS (gepub_archive_range_stream_parent_class)->finalize (object);
+}
+
+static void
+gepub_archive_range_stream_init (GepubArchiveRangeStream *range)
+{
+}
+
+static void
+gepub_archive_range_stream_class_init (GepubArchiveRangeStreamClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+    GInputStreamClass *stream_class = G_INPUT_STREAM_CLASS (klass);
+
+    object_class->finalize = gepub_archive_range_stream_finalize;
+    stream_class->read_fn = gepub_archive_range_stream_read;
+}
+
+static GInputStream *
+gepub_archive_range_stream_new (GepubArchive *archive,
+                                goffset       offset,
+                                guint64       size)
+{
+    GepubArchiveRangeStream *range;
+
+    range = g_object_new (gepub_archive_range_stream_get_type (), NULL);
+    range->archive = g_object_ref (archive);
+    range->offset = offset;
+    range->remaining = size;
+
+    return G_INPUT_STREAM (range);
+}
+
+/**
+ * gepub_archive_open_entry_stream:
+ * @archive: a #GepubArchive
+ * @path: the entry path
+ * @size: (out) (optional): return location for the uncompressed size
+ *
+ * Opens a stream that inflates the entry as it's read, instead of
+ * loading the whole entry in memory. Entries of a memory mapped archive
+ * are read directly from the mapping, the others from the file as the
+ * stream is consumed. Streamed entries are never added to the entry
+ * cache.
+ *
+ * Returns: (transfer full) (nullable): a #GInputStream with the entry
+ * content, or %NULL if it doesn't exist
+ */
+GInputStream *
+gepub_archive_open_entry_stream (GepubArchive *archive,
+                                 const gchar  *path,
+                                 gint64       *size)
+{
+    GepubArchiveEntry *entry = NULL;
+    GInputStream *base, *stream;
+    GConverter *decompressor;
+    GBytes *bytes;
+    goffset data_offset = -1;
+
+    // entries that can't be streamed are read whole, through the scan
+    // if needed
+    if (gepub_archive_ensure_index (archive) &&
+        (entry = gepub_archive_lookup (archive, path)) &&
+        gepub_archive_entry_is_supported (entry))
+        data_offset = gepub_archive_entry_data_offset (archive, entry);
+
+    if (data_offset < 0) {
+        bytes = gepub_archive_read_entry (archive, path);
+        if (!bytes)
+            return NULL;
+
+        if (size)
+            *size = g_bytes_get_size (bytes);
+        stream = g_memory_input_stream_new_from_bytes (bytes);
+        g_bytes_unref (bytes);
+        return stream;
+    }
+
+    if (archive->data) {
+        bytes = gepub_archive_read_range (archive, data_offset, entry->compressed_size);
+        if (!bytes)
+            return NULL;
+
+        base = g_memory_input_stream_new_from_bytes (bytes);
+        g_bytes_unref (bytes);
+    } else {
+        // read from the file as it's consumed, whatever the entry size
+        base = gepub_archive_range_stream_new (archive, data_offset, entry->compressed_size);
+    }
+
+    if (size)
+        *size = entry->uncompressed_size;
+
+    if (entry->method == ZIP_METHOD_STORED)
+        return base;
+
+    decompressor = G_CONVERTER (g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_RAW));
+    stream = g_converter_input_stream_new (base, decompressor);
+    g_object_unref (decompressor);
+    g_object_unref (base);
+
+    return stream;
+}
+
+/**
+ * gepub_archive_set_cache_size:
+ * @archive: a #GepubArchive
+ * @max_size: the cache budget in bytes, 0 to disable the cache
+ *
+ * Keeps up to @max_size bytes of inflated entries in memory, so
+ * resources read again and again, like stylesheets and fonts, are
+ * inflated only once. The least recently used entries are dropped when
+ * the budget is exceeded. The cache is disabled by default.
+ */
+void
+gepub_archive_set_cache_size (GepubArchive *archive,
+                              gsize         max_size)
+{
+    g_return_if_fail (GEPUB_IS_ARCHIVE (archive));
+
+    g_mutex_lock (&archive->cache_lock);
+    archive->cache_max_size = max_size;
+    gepub_archive_cache_evict (archive, max_size);
+    g_mutex_unlock (&archive->cache_lock);
+}
+
+/**
+ * gepub_archive_get_cache_size:
+ * @archive: a #GepubArchive
+ *
+ * Returns: the cache budget in bytes, 0 if the cache is disabled
+ */
+gsize
+gepub_archive_get_cache_size (GepubArchive *archive)
+{
+    gsize max_size;
+
+    g_return_val_if_fail (GEPUB_IS_ARCHIVE (archive), 0);
+
+    g_mutex_lock (&archive->cache_lock);
+    max_size = archive->cache_max_size;
+    g_mutex_unlock (&archive->cache_lock);
+
+    return max_size;
+}
+
+/**
+ * gepub_archive_get_cache_stats:
+ * @archive: a #GepubArchive
+ * @hits: (out) (optional): return location for the number of cache hits
+ * @misses: (out) (optional): return location for the number of cache misses
+ * @size: (out) (optional): return location for the bytes held by the cache
+ *
+ * Gets the entry cache counters, only reads done while the cache is
+ * enabled are counted.
+ */
+void
+gepub_archive_get_cache_stats (GepubArchive *archive,
+                               guint64      *hits,
+                               guint64      *misses,
+                               gsize        *size)
+{
+    g_return_if_fail (GEPUB_IS_ARCHIVE (archive));
+
+    g_mutex_lock (&archive->cache_lock);
+    if (hits)
+        *hits = archive->cache_hits;
+    if (misses)
+        *misses = archive->cache_misses;
+    if (size)
+        *size = archive->cache_size;
+    g_mutex_unlock (&archive->cache_lock);
+}
+
+/* Approximate heap used by the central directory index: the entries,
+ * their names and the table keys, and a slot in each container.
+ */
+gsize
+_gepub_archive_get_index_size (GepubArchive *archive)
+{
+    GHashTableIter iter;
+    gpointer key;
+    gsize size = 0;
+    guint i;
+
+    if (!gepub_archive_ensure_index (archive))
+        return 0;
+
+    for (i = 0; i < archive->entries->len; i++) {
+        GepubArchiveEntry *entry = g_ptr_array_index (archive->entries, i);
+
+        size += sizeof (GepubArchiveEntry) + strlen (entry->name) + 1 + sizeof (gpointer);
+    }
+
+    g_hash_table_iter_init (&iter, archive->index);
+    while (g_hash_table_iter_next (&iter, &key, NULL))
+        size += strlen (key) + 1 + 2 * sizeof (gpointer) + sizeof (guint);
+
+    return size;
+}
+
+/* Serializes the central directory index, so it can be restored with
+ * _gepub_archive_load_index() without reading the archive again.
+ */
+GVariant *
+_gepub_archive_save_index (GepubArchive *archive)
+{
+    GVariantBuilder builder;
+    guint i;
+
+    if (!gepub_archive_ensure_index (archive))
         return NULL;
 
-    while (archive_read_next_header (archive->archive, &entry) == ARCHIVE_OK) {
-        if (g_ascii_strcasecmp (_path, archive_entry_pathname (entry)) == 0)
-            break;
-        archive_read_data_skip (archive->archive);
+    g_variant_builder_init (&builder, G_VARIANT_TYPE (GEPUB_ARCHIVE_INDEX_TYPE));
+    for (i = 0; i < archive->entries->len; i++) {
+        GepubArchiveEntry *entry = g_ptr_array_index (archive->entries, i);
+
+        g_variant_builder_add (&builder, "(stttqqu)",
+                               entry->name,
+                               (guint64) entry->offset,
+                               entry->compressed_size,
+                               entry->uncompressed_size,
+                               entry->method,
+                               entry->flags,
+                               entry->crc);
     }
 
-    size = archive_entry_size (entry);
-    buffer = g_malloc0 (size);
-    archive_read_data (archive->archive, buffer, size);
+    return g_variant_builder_end (&builder);
+}
 
-    gepub_archive_close (archive);
-    return g_bytes_new_take (buffer, size);
+/* Restores an index saved with _gepub_archive_save_index(). It must be
+ * called before anything is read from the archive, returns %FALSE if
+ * the index is already built.
+ */
+gboolean
+_gepub_archive_load_index (GepubArchive *archive,
+                           GVariant     *saved)
+{
+    GVariantIter iter;
+    const gchar *name;
+    guint64 offset, compressed_size, uncompressed_size;
+    guint16 method, flags;
+    guint32 crc;
+
+    g_return_val_if_fail (g_variant_is_of_type (saved, G_VARIANT_TYPE (GEPUB_ARCHIVE_INDEX_TYPE)), FALSE);
+
+    if (!g_once_init_enter (&archive->index_once))
+        return FALSE;
+
+    if (gepub_archive_open (archive)) {
+        archive->entries = g_ptr_array_new_with_free_func ((GDestroyNotify) gepub_archive_entry_free);
+        archive->index = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+        g_variant_iter_init (&iter, saved);
+        while (g_variant_iter_next (&iter, "(&stttqqu)", &name, &offset,
+                                    &compressed_size, &uncompressed_size,
+                                    &method, &flags, &crc)) {
+            GepubArchiveEntry *entry = g_new0 (GepubArchiveEntry, 1);
+
+            entry->name = g_strdup (name);
+            entry->offset = offset;
+            entry->compressed_size = compressed_size;
+            entry->uncompressed_size = uncompressed_size;
+            entry->method = method;
+            entry->flags = flags;
+            entry->crc = crc;
+            gepub_archive_add_entry (archive, entry);
+        }
+    }
+
+    g_once_init_leave (&archive->index_once, 1);
+
+    return archive->index != NULL;
 }
 
 gchar *
 gepub_archive_get_root_file (GepubArchive *archive)
 {
-    xmlDoc *doc = NULL;
-    xmlNode *root_element = NULL;
-    xmlNode *root_node = NULL;
     GBytes *bytes;
-    const gchar *buffer;
-    gsize bufsize;
     gchar *root_file = NULL;
 
     // root file is in META-INF/container.xml
@@ -177,13 +1804,7 @@ gepub_archive_get_root_file (GepubArchive *archive)
     if (!bytes)
         return NULL;
 
-    buffer = g_bytes_get_data (bytes, &bufsize);
-    doc = xmlRecoverMemory (buffer, bufsize);
-    root_element = xmlDocGetRootElement (doc);
-    root_node = gepub_utils_get_element_by_tag (root_element, "rootfile");
-    root_file = gepub_utils_get_prop (root_node, "full-path");
-
-    xmlFreeDoc (doc);
+    root_file = _gepub_utils_get_root_file (bytes);
     g_bytes_unref (bytes);
 
     return root_file;
@@ -39,11 +39,35 @@ typedef struct _GepubArchiveClass GepubArchiveClass;
 GType             gepub_archive_get_type       (void) G_GNUC_CONST;
 
 GepubArchive     *gepub_archive_new            (const gchar  *path);
+GepubArchive     *gepub_archive_new_from_file  (GFile        *file);
+GepubArchive     *gepub_archive_new_from_bytes (GBytes       *bytes);
+GepubArchive     *gepub_archive_new_from_stream (GInputStream *stream);
 GList            *gepub_archive_list_files     (GepubArchive *archive);
 GBytes           *gepub_archive_read_entry     (GepubArchive *archive,
                                                 const gchar *path);
+void              gepub_archive_read_entry_async  (GepubArchive        *archive,
+                                                   const gchar         *path,
+                                                   GCancellable        *cancellable,
+                                                   GAsyncReadyCallback  callback,
+                                                   gpointer             user_data);
+GBytes           *gepub_archive_read_entry_finish (GepubArchive        *archive,
+                                                   GAsyncResult        *result,
+                                                   GError             **error);
+GPtrArray        *gepub_archive_read_entries   (GepubArchive       *archive,
+                                                const gchar * const *paths);
+GInputStream     *gepub_archive_open_entry_stream (GepubArchive *archive,
+                                                   const gchar  *path,
+                                                   gint64       *size);
 gchar            *gepub_archive_get_root_file  (GepubArchive *archive);
 
+void              gepub_archive_set_cache_size  (GepubArchive *archive,
+                                                 gsize         max_size);
+gsize             gepub_archive_get_cache_size  (GepubArchive *archive);
+void              gepub_archive_get_cache_stats (GepubArchive *archive,
+                                                 guint64      *hits,
+                                                 guint64      *misses,
+                                                 gsize        *size);
+
 G_END_DECLS
 
 #endif /* __GEPUB_ARCHIVE_H__ */
@@ -0,0 +1,334 @@
+/* GepubCursor
+ *
+ * Copyright (C) 2011 Daniel Garcia <danigm@wadobo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <config.h>
+
+#include "gepub-cursor.h"
+
+/* A reading position in a doc. The doc is only read through its
+ * chapter index based API, so any number of cursors, in any thread,
+ * can share it. A cursor itself belongs to one reader.
+ */
+struct _GepubCursor {
+    GObject parent;
+
+    GepubDoc *doc;
+    gint chapter;               // -1 if the spine is empty
+};
+
+struct _GepubCursorClass {
+    GObjectClass parent_class;
+};
+
+enum {
+    PROP_0,
+    PROP_DOC,
+    PROP_CHAPTER,
+    NUM_PROPS
+};
+
+static GParamSpec *properties[NUM_PROPS] = { NULL, };
+
+G_DEFINE_TYPE (GepubCursor, gepub_cursor, G_TYPE_OBJECT)
+
+static void
+gepub_cursor_finalize (GObject *object)
+{
+    GepubCursor *cursor = GEPUB_CURSOR (object);
+
+    g_clear_object (&cursor->doc);
+
+    G_OBJECT_CLASS (gepub_cursor_parent_class)->finalize (object);
+}
+
+static void
+gepub_cursor_set_property (GObject      *object,
+                           guint         prop_id,
+                           const GValue *value,
+                           GParamSpec   *pspec)
+{
+    GepubCursor *cursor = GEPUB_CURSOR (object);
+
+    switch (prop_id) {
+    case PROP_DOC:
+        cursor->doc = g_value_dup_object (value);
+        break;
+    case PROP_CHAPTER:
+        gepub_cursor_set_chapter (cursor, g_value_get_int (value));
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+        break;
+    }
+}
+
+static void
+gepub_cursor_get_property (GObject    *object,
+                           guint       prop_id,
+                           GValue     *value,
+                           GParamSpec *pspec)
+{
+    GepubCursor *cursor = GEPUB_CURSOR (object);
+
+    switch (prop_id) {
+    case PROP_DOC:
+        g_value_set_object (value, cursor->doc);
+        break;
+    case PROP_CHAPTER:
+        g_value_set_int (value, cursor->chapter);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+        break;
+    }
+}
+
+static void
+gepub_cursor_constructed (GObject *object)
+{
+    GepubCursor *cursor = GEPUB_CURSOR (object);
+
+    G_OBJECT_CLASS (gepub_cursor_parent_class)->constructed (object);
+
+    cursor->chapter = gepub_doc_get_n_chapters (cursor->doc) > 0 ? 0 : -1;
+}
+
+static void
+gepub_cursor_init (GepubCursor *cursor)
+{
+    cursor->chapter = -1;
+}
+
+static void
+gepub_cursor_class_init (GepubCursorClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    object_class->constructed = gepub_cursor_constructed;
+    object_class->finalize = gepub_cursor_finalize;
+    object_class->set_property = gepub_cursor_set_property;
+    object_class->get_property = gepub_cursor_get_property;
+
+    properties[PROP_DOC] =
+        g_param_spec_object ("doc",
+                             "Doc",
+                             "The GepubDoc read",
+                             GEPUB_TYPE_DOC,
+                             G_PARAM_READWRITE |
+                             G_PARAM_CONSTRUCT_ONLY |
+                             G_PARAM_STATIC_STRINGS);
+    properties[PROP_CHAPTER] =
+        g_param_spec_int ("chapter",
+                          "Current chapter",
+                          "The current chapter index",
+                          -1, G_MAXINT, 0,
+                          G_PARAM_READWRITE |
+                          G_PARAM_EXPLICIT_NOTIFY |
+                          G_PARAM_STATIC_STRINGS);
+
+    g_object_class_install_properties (object_class, NUM_PROPS, properties);
+}
+
+/**
+ * gepub_cursor_new:
+ * @doc: a #GepubDoc
+ *
+ * Creates a reading position in @doc, at its first chapter. It doesn't
+ * parse or copy anything, and the doc current chapter is not used.
+ *
+ * Returns: (transfer full): the new #GepubCursor
+ */
+GepubCursor *
+gepub_cursor_new (GepubDoc *doc)
+{
+    g_return_val_if_fail (GEPUB_IS_DOC (doc), NULL);
+
+    return g_object_new (GEPUB_TYPE_CURSOR,
+                         "doc", doc,
+                         NULL);
+}
+
+/**
+ * gepub_cursor_get_doc:
+ * @cursor: a #GepubCursor
+ *
+ * Returns: (transfer none): the #GepubDoc
+ */
+GepubDoc *
+gepub_cursor_get_doc (GepubCursor *cursor)
+{
+    g_return_val_if_fail (GEPUB_IS_CURSOR (cursor), NULL);
+
+    return cursor->doc;
+}
+
+static gboolean
+gepub_cursor_set_chapter_internal (GepubCursor *cursor,
+                                   gint         chapter)
+{
+    if (chapter < 0 || chapter >= gepub_doc_get_n_chapters (cursor->doc) ||
+        cursor->chapter == chapter)
+        return FALSE;
+
+    cursor->chapter = chapter;
+    g_object_notify_by_pspec (G_OBJECT (cursor), properties[PROP_CHAPTER]);
+
+    return TRUE;
+}
+
+/**
+ * gepub_cursor_get_chapter:
+ * @cursor: a #GepubCursor
+ *
+ * Returns: the current chapter index, starting from 0
+ */
+gint
+gepub_cursor_get_chapter (GepubCursor *cursor)
+{
+    g_return_val_if_fail (GEPUB_IS_CURSOR (cursor), 0);
+
+    return cursor->chapter;
+}
+
+/**
+ * gepub_cursor_set_chapter:
+ * @cursor: a #GepubCursor
+ * @index: the index of the new chapter
+ *
+ * Sets the cursor current chapter to the @index spine element.
+ */
+void
+gepub_cursor_set_chapter (GepubCursor *cursor,
+                          gint         index)
+{
+    g_return_if_fail (GEPUB_IS_CURSOR (cursor));
+    g_return_if_fail (index >= 0 && index < gepub_doc_get_n_chapters (cursor->doc));
+
+    gepub_cursor_set_chapter_internal (cursor, index);
+}
+
+/**
+ * gepub_cursor_go_next:
+ * @cursor: a #GepubCursor
+ *
+ * Returns: TRUE on success, FALSE if there's no next chapter
+ */
+gboolean
+gepub_cursor_go_next (GepubCursor *cursor)
+{
+    g_return_val_if_fail (GEPUB_IS_CURSOR (cursor), FALSE);
+    g_return_val_if_fail (cursor->chapter >= 0, FALSE);
+
+    return gepub_cursor_set_chapter_internal (cursor, cursor->chapter + 1);
+}
+
+/**
+ * gepub_cursor_go_prev:
+ * @cursor: a #GepubCursor
+ *
+ * Returns: TRUE on success, FALSE if there's no previous chapter
+ */
+gboolean
+gepub_cursor_go_prev (GepubCursor *cursor)
+{
+    g_return_val_if_fail (GEPUB_IS_CURSOR (cursor), FALSE);
+    g_return_val_if_fail (cursor->chapter >= 0, FALSE);
+
+    return gepub_cursor_set_chapter_internal (cursor, cursor->chapter - 1);
+}
+
+/**
+ * gepub_cursor_get_current_id:
+ * @cursor: a #GepubCursor
+ *
+ * Returns: (transfer none): the current resource id
+ */
+const gchar *
+gepub_cursor_get_current_id (GepubCursor *cursor)
+{
+    g_return_val_if_fail (GEPUB_IS_CURSOR (cursor), NULL);
+    g_return_val_if_fail (cursor->chapter >= 0, NULL);
+
+    return gepub_doc_get_chapter_id (cursor->doc, cursor->chapter);
+}
+
+/**
+ * gepub_cursor_get_current_path:
+ * @cursor: a #GepubCursor
+ *
+ * Returns: (transfer full): the current resource path
+ */
+gchar *
+gepub_cursor_get_current_path (GepubCursor *cursor)
+{
+    g_return_val_if_fail (GEPUB_IS_CURSOR (cursor), NULL);
+    g_return_val_if_fail (cursor->chapter >= 0, NULL);
+
+    return gepub_doc_get_resource_path (cursor->doc, gepub_cursor_get_current_id (cursor));
+}
+
+/**
+ * gepub_cursor_get_current_mime:
+ * @cursor: a #GepubCursor
+ *
+ * Returns: (transfer full): the current resource mime
+ */
+gchar *
+gepub_cursor_get_current_mime (GepubCursor *cursor)
+{
+    g_return_val_if_fail (GEPUB_IS_CURSOR (cursor), NULL);
+    g_return_val_if_fail (cursor->chapter >= 0, NULL);
+
+    return gepub_doc_get_resource_mime_by_id (cursor->doc, gepub_cursor_get_current_id (cursor));
+}
+
+/**
+ * gepub_cursor_get_current:
+ * @cursor: a #GepubCursor
+ *
+ * Returns: (transfer full): the current chapter data
+ */
+GBytes *
+gepub_cursor_get_current (GepubCursor *cursor)
+{
+    g_return_val_if_fail (GEPUB_IS_CURSOR (cursor), NULL);
+    g_return_val_if_fail (cursor->chapter >= 0, NULL);
+
+    return gepub_doc_get_resource_by_id (cursor->doc, gepub_cursor_get_current_id (cursor));
+}
+
+/**
+ * gepub_cursor_get_current_with_epub_uris:
+ * @cursor: a #GepubCursor
+ *
+ * To load it without blocking, use
+ * gepub_doc_get_chapter_with_epub_uris_async() with the cursor chapter.
+ *
+ * Returns: (transfer full): the current chapter data, with resource uris
+ * renamed so they have the epub:/// prefix and all are relative to the
+ * root file
+ */
+GBytes *
+gepub_cursor_get_current_with_epub_uris (GepubCursor *cursor)
+{
+    g_return_val_if_fail (GEPUB_IS_CURSOR (cursor), NULL);
+    g_return_val_if_fail (cursor->chapter >= 0, NULL);
+
+    return gepub_doc_get_chapter_with_epub_uris (cursor->doc, cursor->chapter);
+}
@@ -0,0 +1,59 @@
+/* GepubCursor
+ *
+ * Copyright (C) 2011  Daniel Garcia <danigm@wadobo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GEPUB_CURSOR_H__
+#define __GEPUB_CURSOR_H__
+
+#include <glib-object.h>
+#include <glib.h>
+
+#include "gepub-doc.h"
+
+G_BEGIN_DECLS
+
+#define GEPUB_TYPE_CURSOR           (gepub_cursor_get_type ())
+#define GEPUB_CURSOR(obj)           (G_TYPE_CHECK_INSTANCE_CAST (obj, GEPUB_TYPE_CURSOR, GepubCursor))
+#define GEPUB_CURSOR_CLASS(cls)     (G_TYPE_CHECK_CLASS_CAST (cls, GEPUB_TYPE_CURSOR, GepubCursorClass))
+#define GEPUB_IS_CURSOR(obj)        (G_TYPE_CHECK_INSTANCE_TYPE (obj, GEPUB_TYPE_CURSOR))
+#define GEPUB_IS_CURSOR_CLASS(obj)  (G_TYPE_CHECK_CLASS_TYPE (obj, GEPUB_TYPE_CURSOR))
+#define GEPUB_CURSOR_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS ((obj), GEPUB_TYPE_CURSOR, GepubCursorClass))
+
+typedef struct _GepubCursor      GepubCursor;
+typedef struct _GepubCursorClass GepubCursorClass;
+
+GType             gepub_cursor_get_type                        (void) G_GNUC_CONST;
+
+GepubCursor      *gepub_cursor_new                             (GepubDoc *doc);
+GepubDoc         *gepub_cursor_get_doc                         (GepubCursor *cursor);
+
+gint              gepub_cursor_get_chapter                     (GepubCursor *cursor);
+void              gepub_cursor_set_chapter                     (GepubCursor *cursor,
+                                                                gint         index);
+gboolean          gepub_cursor_go_next                         (GepubCursor *cursor);
+gboolean          gepub_cursor_go_prev                         (GepubCursor *cursor);
+
+const gchar      *gepub_cursor_get_current_id                  (GepubCursor *cursor);
+gchar            *gepub_cursor_get_current_path                (GepubCursor *cursor);
+gchar            *gepub_cursor_get_current_mime                (GepubCursor *cursor);
+GBytes           *gepub_cursor_get_current                     (GepubCursor *cursor);
+GBytes           *gepub_cursor_get_current_with_epub_uris      (GepubCursor *cursor);
+
+G_END_DECLS
+
+#endif /* __GEPUB_CURSOR_H__ */
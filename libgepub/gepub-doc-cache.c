@@ -0,0 +1,316 @@
+/* GepubDoc cache
+ *
+ * Copyright (C) 2011 Daniel Garcia <danigm@wadobo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <config.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+
+#include "gepub-doc-cache.h"
+
+#define GEPUB_DOC_CACHE_BUDGET (64 * 1024 * 1024)
+
+/* Every doc handed out is tracked with a weak reference, so it's shared
+ * while anyone uses it and goes away with its last reference. On top of
+ * that, the most recently used docs are kept alive by the LRU queue, so
+ * the popular ones aren't parsed again between two readers, as long as
+ * their memory, as told by gepub_doc_get_memory_stats() when they were
+ * last handed out, fits in the budget.
+ */
+typedef struct {
+    GepubDoc *doc;
+    gsize size;
+} GepubDocCacheEntry;
+
+static GMutex cache_lock;
+static GHashTable *cache_docs;          // file identity -> GWeakRef of the doc
+static GQueue cache_lru = G_QUEUE_INIT; // GepubDocCacheEntry, most recently used first
+static GHashTable *cache_links;         // doc -> its link in cache_lru
+static gsize cache_size;                // the sizes of the docs in cache_lru
+static gsize cache_budget = GEPUB_DOC_CACHE_BUDGET;
+
+static void
+gepub_doc_cache_weak_ref_free (GWeakRef *ref)
+{
+    g_weak_ref_clear (ref);
+    g_free (ref);
+}
+
+/* The same file, even through another path or a hard link, until it's
+ * modified.
+ */
+static gchar *
+gepub_doc_cache_identity (const gchar *path, GError **error)
+{
+    GStatBuf st;
+
+    if (g_stat (path, &st) != 0) {
+        int errsv = errno;
+
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                     "Can't open %s: %s", path, g_strerror (errsv));
+        return NULL;
+    }
+
+    return g_strdup_printf ("%" G_GUINT64_FORMAT ":%" G_GUINT64_FORMAT ":%"
+                            G_GUINT64_FORMAT ":%" G_GINT64_FORMAT,
+                            (guint64) st.st_dev, (guint64) st.st_ino,
+                            (guint64) st.st_size, (gint64) st.st_mtime);
+}
+
+static GepubDoc *
+gepub_doc_cache_lookup_locked (const gchar *key)
+{
+    GWeakRef *ref;
+    GepubDoc *doc;
+
+    if (!cache_docs)
+        return NULL;
+
+    ref = g_hash_table_lookup (cache_docs, key);
+    if (!ref)
+        return NULL;
+
+    doc = g_weak_ref_get (ref);
+    if (!doc)
+        g_hash_table_remove (cache_docs, key);
+
+    return doc;
+}
+
+static void
+gepub_doc_cache_insert_locked (gchar *key, GepubDoc *doc)
+{
+    GHashTableIter iter;
+    gpointer value;
+    GWeakRef *ref;
+
+    if (!cache_docs) {
+        cache_docs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                            (GDestroyNotify) gepub_doc_cache_weak_ref_free);
+    }
+
+    // forget the docs that are gone
+    g_hash_table_iter_init (&iter, cache_docs);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        GObject *alive = g_weak_ref_get (value);
+
+        if (alive)
+            g_object_unref (alive);
+        else
+            g_hash_table_iter_remove (&iter);
+    }
+
+    ref = g_new0 (GWeakRef, 1);
+    g_weak_ref_init (ref, doc);
+    g_hash_table_replace (cache_docs, key, ref);
+}
+
+static gsize
+gepub_doc_cache_doc_size (GepubDoc *doc)
+{
+    GepubMemoryStats stats;
+
+    gepub_doc_get_memory_stats (doc, &stats);
+
+    return stats.total;
+}
+
+/* Moves @doc to the front of the LRU queue with its new @size, then
+ * drops the least recently used docs until the rest fit in the budget.
+ * Returns the docs pushed out, to be unreferenced once the lock is
+ * released.
+ */
+static GList *
+gepub_doc_cache_touch_locked (GepubDoc *doc, gsize size)
+{
+    GepubDocCacheEntry *entry;
+    GList *link, *evicted = NULL;
+
+    if (doc) {
+        if (!cache_links)
+            cache_links = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+        link = g_hash_table_lookup (cache_links, doc);
+        if (link) {
+            entry = link->data;
+            cache_size -= entry->size;
+            g_queue_unlink (&cache_lru, link);
+            g_queue_push_head_link (&cache_lru, link);
+        } else {
+            entry = g_new (GepubDocCacheEntry, 1);
+            entry->doc = g_object_ref (doc);
+            g_queue_push_head (&cache_lru, entry);
+            g_hash_table_insert (cache_links, doc, cache_lru.head);
+        }
+        entry->size = size;
+        cache_size += size;
+    }
+
+    while (cache_lru.tail && cache_size > cache_budget) {
+        entry = g_queue_pop_tail (&cache_lru);
+        g_hash_table_remove (cache_links, entry->doc);
+        cache_size -= entry->size;
+        evicted = g_list_prepend (evicted, entry->doc);
+        g_free (entry);
+    }
+
+    return evicted;
+}
+
+/* The docs grow as they're read, so @doc is measured again each time
+ * it's handed out. That's done without the lock, the other docs aren't
+ * measured at all.
+ */
+static void
+gepub_doc_cache_touch (GepubDoc *doc)
+{
+    gsize size = gepub_doc_cache_doc_size (doc);
+    GList *evicted;
+
+    g_mutex_lock (&cache_lock);
+    evicted = gepub_doc_cache_touch_locked (doc, size);
+    g_mutex_unlock (&cache_lock);
+
+    g_list_free_full (evicted, g_object_unref);
+}
+
+/**
+ * gepub_doc_cache_get:
+ * @path: the epub doc path
+ * @error: (nullable): Error
+ *
+ * Gets the doc at @path, opening it only if it's not already open in
+ * this process. Files are told apart by device, inode, size and
+ * modification time, not by path. The doc is shared, so use a
+ * #GepubCursor for each reader instead of the doc current chapter.
+ *
+ * Returns: (transfer full): the shared #GepubDoc
+ */
+GepubDoc *
+gepub_doc_cache_get (const gchar *path, GError **error)
+{
+    gchar *key;
+    GepubDoc *doc, *opened;
+
+    g_return_val_if_fail (path != NULL, NULL);
+
+    key = gepub_doc_cache_identity (path, error);
+    if (!key)
+        return NULL;
+
+    g_mutex_lock (&cache_lock);
+    doc = gepub_doc_cache_lookup_locked (key);
+    g_mutex_unlock (&cache_lock);
+    if (doc) {
+        gepub_doc_cache_touch (doc);
+        g_free (key);
+        return doc;
+    }
+
+    // not holding the lock, other books can be opened meanwhile
+    opened = gepub_doc_new (path, error);
+    if (!opened) {
+        g_free (key);
+        return NULL;
+    }
+
+    g_mutex_lock (&cache_lock);
+    doc = gepub_doc_cache_lookup_locked (key);
+    if (doc) {
+        // another thread opened it first
+        g_free (key);
+    } else {
+        doc = g_object_ref (opened);
+        gepub_doc_cache_insert_locked (key, doc);
+    }
+    g_mutex_unlock (&cache_lock);
+
+    gepub_doc_cache_touch (doc);
+    g_object_unref (opened);
+
+    return doc;
+}
+
+/**
+ * gepub_doc_cache_get_budget:
+ *
+ * Returns: the bytes the recently used docs can hold, see
+ * gepub_doc_cache_set_budget()
+ */
+gsize
+gepub_doc_cache_get_budget (void)
+{
+    gsize budget;
+
+    g_mutex_lock (&cache_lock);
+    budget = cache_budget;
+    g_mutex_unlock (&cache_lock);
+
+    return budget;
+}
+
+/**
+ * gepub_doc_cache_set_budget:
+ * @max_size: the budget in bytes
+ *
+ * Sets how much memory the most recently used docs can hold, counted
+ * with gepub_doc_get_memory_stats(), to stay open after their last user
+ * is gone and be handed out again without parsing. Docs still in use
+ * are never closed. Use 0 to close docs as soon as they're not used.
+ * The default is 64MiB.
+ */
+void
+gepub_doc_cache_set_budget (gsize max_size)
+{
+    GList *evicted;
+
+    g_mutex_lock (&cache_lock);
+    cache_budget = max_size;
+    evicted = gepub_doc_cache_touch_locked (NULL, 0);
+    g_mutex_unlock (&cache_lock);
+
+    g_list_free_full (evicted, g_object_unref);
+}
+
+/**
+ * gepub_doc_cache_clear:
+ *
+ * Releases the docs kept open by the cache and forgets the ones in use,
+ * so the next gepub_doc_cache_get() opens the files again.
+ */
+void
+gepub_doc_cache_clear (void)
+{
+    GepubDocCacheEntry *entry;
+    GList *evicted = NULL;
+
+    g_mutex_lock (&cache_lock);
+    while ((entry = g_queue_pop_head (&cache_lru))) {
+        evicted = g_list_prepend (evicted, entry->doc);
+        g_free (entry);
+    }
+    cache_size = 0;
+    if (cache_links)
+        g_hash_table_remove_all (cache_links);
+    if (cache_docs)
+        g_hash_table_remove_all (cache_docs);
+    g_mutex_unlock (&cache_lock);
+
+    g_list_free_full (evicted, g_object_unref);
+}
@@ -0,0 +1,37 @@
+/* GepubDoc cache
+ *
+ * Copyright (C) 2011  Daniel Garcia <danigm@wadobo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GEPUB_DOC_CACHE_H__
+#define __GEPUB_DOC_CACHE_H__
+
+#include <glib.h>
+
+#include "gepub-doc.h"
+
+G_BEGIN_DECLS
+
+GepubDoc         *gepub_doc_cache_get                       (const gchar *path,
+                                                             GError     **error);
+gsize             gepub_doc_cache_get_budget                (void);
+void              gepub_doc_cache_set_budget                (gsize max_size);
+void              gepub_doc_cache_clear                     (void);
+
+G_END_DECLS
+
+#endif /* __GEPUB_DOC_CACHE_H__ */
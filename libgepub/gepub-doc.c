@@ -20,12 +20,16 @@
 #include <config.h>
 #include <libxml/tree.h>
 #include <libxml/HTMLparser.h>
+#include <glib/gstdio.h>
+#include <errno.h>
 #include <string.h>
 
 #include "gepub-utils.h"
 #include "gepub-doc.h"
 #include "gepub-archive.h"
+#include "gepub-archive-private.h"
 #include "gepub-text-chunk.h"
+#include "gepub-trace-private.h"
 
 
 static GQuark
@@ -47,26 +51,89 @@ typedef enum {
     GEPUB_ERROR_INVALID = 0,  /*< nick=Invalid >*/
 } GepubDocError;
 
+#define GEPUB_MIMETYPE "application/epub+zip"
+
+/* Bump the version when the index cache format changes, old caches
+ * are then ignored and rewritten.
+ *
+ * version, path, size, mtime, inode, content path, content base,
+ * manifest (id, mime, uri), spine, nav id, toc id, metadata, cover,
+ * flattened TOC (label, content, fragment, play order, depth, parent,
+ * chapter), archive index
+ */
+#define GEPUB_DOC_INDEX_CACHE_VERSION 6
+#define GEPUB_DOC_INDEX_CACHE_TYPE "(ustxtssa(smss)asmsmsa{sas}msa(msmsmstiii)" GEPUB_ARCHIVE_INDEX_TYPE ")"
+
 
 
-static void gepub_doc_fill_resources (GepubDoc *doc);
-static void gepub_doc_fill_spine (GepubDoc *doc);
-static void gepub_doc_fill_toc (GepubDoc *doc, gchar *toc_id);
+static void gepub_doc_parse_package (GepubDoc *doc, gboolean metadata_only);
+static void gepub_doc_fill_toc (GepubDoc *doc);
+static void gepub_doc_ensure_toc (GepubDoc *doc);
 static void gepub_doc_initable_iface_init (GInitableIface *iface);
+static void gepub_doc_async_initable_iface_init (GAsyncInitableIface *iface);
 static gint navpoint_compare (GepubNavPoint *a, GepubNavPoint *b);
+static void gepub_doc_readahead_schedule (GepubDoc *doc);
+
+/* Chapters inflated and rewritten by the read-ahead worker, shared
+ * with the worker so it can outlive the doc.
+ */
+typedef struct {
+    gint ref_count;
+    GMutex lock;
+    GHashTable *chapters;   // spine id -> chapter with epub uris
+} GepubReadahead;
 
 struct _GepubDoc {
     GObject parent;
 
     GepubArchive *archive;
     GBytes *content;
+    gsize content_once;
     gchar *content_base;
     gchar *path;
+    GFile *file;
+    GBytes *bytes;
+    GInputStream *stream;
+    GepubDocOpenFlags flags;
+    gchar *content_path;
     GHashTable *resources;
-
-    GList *spine;
-    GList *chapter;
+    GHashTable *resource_uris;  // uri -> resource id
+    GHashTable *resource_mimes; // mime -> GPtrArray of resource ids
+    GHashTable *metadata;
+    gchar *cover;
+
+    // package entries read in a single pass while the doc is opened
+    GHashTable *prefetched;
+
+    // every string of the manifest, spine and TOC, ids and mime types
+    // are interned
+    GStringChunk *strings;
+    GHashTable *interned;       // the strings stored only once
+    gsize strings_size;
+    GArray *manifest;           // GepubManifestItem, in manifest order
+    GArray *toc_entries;        // top level GepubNavPoint, in play order
+    GArray *toc_tree;           // GepubTocEntry, in document order
+    GArray *toc_by_chapter;     // toc_tree indices, sorted by chapter
+    GHashTable *toc_fragments;  // "uri#fragment" -> toc_tree index + 1
+
+    GPtrArray *spine;           // resource ids in reading order
+    GHashTable *spine_index;    // resource id -> chapter index + 1
+    gint chapter;               // -1 if the spine is empty
+    // the nav document or the NCX is only parsed when the TOC is
+    // first asked for, under toc_lock as it adds to the strings
+    const gchar *nav_id;
+    const gchar *toc_id;
+    GMutex toc_lock;
+    gint toc_built;
     GList *toc;
+
+    // the pointer is swapped under readahead_lock, as the chapters can
+    // be looked up from any thread
+    GMutex readahead_lock;
+    GepubReadahead *readahead;
+    GCancellable *readahead_cancellable;
+    guint readahead_ahead;
+    guint readahead_behind;
 };
 
 struct _GepubDocClass {
@@ -76,6 +143,10 @@ struct _GepubDocClass {
 enum {
     PROP_0,
     PROP_PATH,
+    PROP_FILE,
+    PROP_BYTES,
+    PROP_STREAM,
+    PROP_FLAGS,
     PROP_CHAPTER,
     NUM_PROPS
 };
@@ -83,14 +154,63 @@ enum {
 static GParamSpec *properties[NUM_PROPS] = { NULL, };
 
 G_DEFINE_TYPE_WITH_CODE (GepubDoc, gepub_doc, G_TYPE_OBJECT,
-                         G_IMPLEMENT_INTERFACE (G_TYPE_INITABLE, gepub_doc_initable_iface_init))
+                         G_IMPLEMENT_INTERFACE (G_TYPE_INITABLE, gepub_doc_initable_iface_init)
+                         G_IMPLEMENT_INTERFACE (G_TYPE_ASYNC_INITABLE, gepub_doc_async_initable_iface_init))
+
+GType
+gepub_doc_open_flags_get_type (void)
+{
+    static gsize type_id = 0;
+    static const GFlagsValue values[] = {
+        { GEPUB_DOC_OPEN_NONE, "GEPUB_DOC_OPEN_NONE", "none" },
+        { GEPUB_DOC_OPEN_INDEX_CACHE, "GEPUB_DOC_OPEN_INDEX_CACHE", "index-cache" },
+        { GEPUB_DOC_OPEN_METADATA_ONLY, "GEPUB_DOC_OPEN_METADATA_ONLY", "metadata-only" },
+        { 0, NULL, NULL }
+    };
+
+    if (g_once_init_enter (&type_id)) {
+        GType type = g_flags_register_static (g_intern_static_string ("GepubDocOpenFlags"), values);
+        g_once_init_leave (&type_id, type);
+    }
+
+    return type_id;
+}
+
+typedef struct {
+    const gchar *id;
+    GepubResource res;
+} GepubManifestItem;
+
+static GepubReadahead *
+gepub_readahead_new (void)
+{
+    GepubReadahead *readahead = g_new0 (GepubReadahead, 1);
+
+    readahead->ref_count = 1;
+    g_mutex_init (&readahead->lock);
+    readahead->chapters = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                 g_free, (GDestroyNotify) g_bytes_unref);
+
+    return readahead;
+}
+
+static GepubReadahead *
+gepub_readahead_ref (GepubReadahead *readahead)
+{
+    g_atomic_int_inc (&readahead->ref_count);
+
+    return readahead;
+}
 
 static void
-gepub_resource_free (GepubResource *res)
+gepub_readahead_unref (GepubReadahead *readahead)
 {
-    g_free (res->mime);
-    g_free (res->uri);
-    g_free (res);
+    if (!g_atomic_int_dec_and_test (&readahead->ref_count))
+        return;
+
+    g_hash_table_destroy (readahead->chapters);
+    g_mutex_clear (&readahead->lock);
+    g_free (readahead);
 }
 
 static void
@@ -98,17 +218,39 @@ gepub_doc_finalize (GObject *object)
 {
     GepubDoc *doc = GEPUB_DOC (object);
 
+    if (doc->readahead_cancellable) {
+        g_cancellable_cancel (doc->readahead_cancellable);
+        g_clear_object (&doc->readahead_cancellable);
+    }
+    g_clear_pointer (&doc->readahead, gepub_readahead_unref);
+    g_mutex_clear (&doc->readahead_lock);
+    g_mutex_clear (&doc->toc_lock);
+
     g_clear_object (&doc->archive);
     g_clear_pointer (&doc->content, g_bytes_unref);
+    g_clear_pointer (&doc->content_path, g_free);
+    g_clear_pointer (&doc->content_base, g_free);
     g_clear_pointer (&doc->path, g_free);
+    g_clear_object (&doc->file);
+    g_clear_pointer (&doc->bytes, g_bytes_unref);
+    g_clear_object (&doc->stream);
+    g_clear_pointer (&doc->resource_uris, g_hash_table_destroy);
+    g_clear_pointer (&doc->resource_mimes, g_hash_table_destroy);
     g_clear_pointer (&doc->resources, g_hash_table_destroy);
+    g_clear_pointer (&doc->metadata, g_hash_table_destroy);
+    g_clear_pointer (&doc->cover, g_free);
 
-    if (doc->spine) {
-        g_list_foreach (doc->spine, (GFunc)g_free, NULL);
-        g_clear_pointer (&doc->spine, g_list_free);
-        g_list_foreach (doc->toc, (GFunc)g_free, NULL);
-        g_clear_pointer (&doc->toc, g_list_free);
-    }
+    g_clear_pointer (&doc->spine_index, g_hash_table_destroy);
+    g_clear_pointer (&doc->spine, g_ptr_array_unref);
+    g_clear_pointer (&doc->toc, g_list_free);
+
+    g_clear_pointer (&doc->manifest, g_array_unref);
+    g_clear_pointer (&doc->toc_entries, g_array_unref);
+    g_clear_pointer (&doc->toc_tree, g_array_unref);
+    g_clear_pointer (&doc->toc_by_chapter, g_array_unref);
+    g_clear_pointer (&doc->toc_fragments, g_hash_table_destroy);
+    g_clear_pointer (&doc->interned, g_hash_table_destroy);
+    g_clear_pointer (&doc->strings, g_string_chunk_free);
 
     G_OBJECT_CLASS (gepub_doc_parent_class)->finalize (object);
 }
@@ -125,6 +267,18 @@ gepub_doc_set_property (GObject      *object,
     case PROP_PATH:
         doc->path = g_value_dup_string (value);
         break;
+    case PROP_FILE:
+        doc->file = g_value_dup_object (value);
+        break;
+    case PROP_BYTES:
+        doc->bytes = g_value_dup_boxed (value);
+        break;
+    case PROP_STREAM:
+        doc->stream = g_value_dup_object (value);
+        break;
+    case PROP_FLAGS:
+        doc->flags = g_value_get_flags (value);
+        break;
     case PROP_CHAPTER:
         gepub_doc_set_chapter (doc, g_value_get_int (value));
         break;
@@ -146,6 +300,18 @@ gepub_doc_get_property (GObject    *object,
     case PROP_PATH:
         g_value_set_string (value, doc->path);
         break;
+    case PROP_FILE:
+        g_value_set_object (value, doc->file);
+        break;
+    case PROP_BYTES:
+        g_value_set_boxed (value, doc->bytes);
+        break;
+    case PROP_STREAM:
+        g_value_set_object (value, doc->stream);
+        break;
+    case PROP_FLAGS:
+        g_value_set_flags (value, doc->flags);
+        break;
     case PROP_CHAPTER:
         g_value_set_int (value, gepub_doc_get_chapter (doc));
         break;
@@ -158,13 +324,197 @@ gepub_doc_get_property (GObject    *object,
 static void
 gepub_doc_init (GepubDoc *doc)
 {
-    /* doc resources hashtable:
+    doc->strings = g_string_chunk_new (4096);
+    doc->interned = g_hash_table_new (g_str_hash, g_str_equal);
+    g_mutex_init (&doc->readahead_lock);
+    g_mutex_init (&doc->toc_lock);
+    doc->manifest = g_array_new (FALSE, FALSE, sizeof (GepubManifestItem));
+    doc->toc_entries = g_array_new (FALSE, FALSE, sizeof (GepubNavPoint));
+    doc->toc_tree = g_array_new (FALSE, FALSE, sizeof (GepubTocEntry));
+    doc->toc_by_chapter = g_array_new (FALSE, FALSE, sizeof (guint));
+    doc->toc_fragments = g_hash_table_new (g_str_hash, g_str_equal);
+
+    /* doc resources hashtable, pointing to the manifest:
      * id : (mime, path)
      */
-    doc->resources = g_hash_table_new_full (g_str_hash,
-                                            g_str_equal,
-                                            (GDestroyNotify)g_free,
-                                            (GDestroyNotify)gepub_resource_free);
+    doc->resources = g_hash_table_new (g_str_hash, g_str_equal);
+
+    /* reverse indices, borrowing the resources strings:
+     * uri : id
+     * mime : [id, ...]
+     */
+    doc->resource_uris = g_hash_table_new (g_str_hash, g_str_equal);
+    doc->resource_mimes = g_hash_table_new_full (g_str_hash,
+                                                 g_str_equal,
+                                                 NULL,
+                                                 (GDestroyNotify)g_ptr_array_unref);
+
+    /* doc metadata hashtable:
+     * name : NULL terminated list of values
+     */
+    doc->metadata = g_hash_table_new_full (g_str_hash,
+                                           g_str_equal,
+                                           (GDestroyNotify)g_free,
+                                           (GDestroyNotify)g_strfreev);
+
+    /* doc spine, the index hashtable borrows the array ids:
+     * id : chapter index + 1
+     */
+    doc->spine = g_ptr_array_new ();
+    doc->spine_index = g_hash_table_new (g_str_hash, g_str_equal);
+    doc->chapter = -1;
+}
+
+static gchar *
+gepub_doc_store (GepubDoc *doc, const gchar *str)
+{
+    if (!str)
+        return NULL;
+
+    doc->strings_size += strlen (str) + 1;
+    return g_string_chunk_insert (doc->strings, str);
+}
+
+// ids and mime types are repeated a lot, so they're stored only once
+static gchar *
+gepub_doc_intern (GepubDoc *doc, const gchar *str)
+{
+    gchar *interned;
+
+    if (!str)
+        return NULL;
+
+    interned = g_hash_table_lookup (doc->interned, str);
+    if (!interned) {
+        interned = gepub_doc_store (doc, str);
+        g_hash_table_add (doc->interned, interned);
+    }
+
+    return interned;
+}
+
+static void
+gepub_doc_add_resource (GepubDoc    *doc,
+                        const gchar *id,
+                        const gchar *mime,
+                        const gchar *uri)
+{
+    GepubManifestItem item;
+
+    if (!id)
+        return;
+
+    item.id = gepub_doc_intern (doc, id);
+    item.res.mime = gepub_doc_intern (doc, mime);
+    item.res.uri = gepub_doc_store (doc, uri);
+    g_array_append_val (doc->manifest, item);
+}
+
+/* Builds the resource tables once the manifest is complete, so the
+ * pointers to the manifest items don't move anymore. Like the spine,
+ * the first resource with a given id or uri wins.
+ */
+static void
+gepub_doc_index_resources (GepubDoc *doc)
+{
+    GPtrArray *ids;
+    guint i;
+
+    for (i = 0; i < doc->manifest->len; i++) {
+        GepubManifestItem *item = &g_array_index (doc->manifest, GepubManifestItem, i);
+        GepubResource *res = &item->res;
+
+        if (g_hash_table_contains (doc->resources, item->id))
+            continue;
+
+        g_hash_table_insert (doc->resources, (gpointer) item->id, res);
+
+        if (res->uri && !g_hash_table_contains (doc->resource_uris, res->uri))
+            g_hash_table_insert (doc->resource_uris, res->uri, (gpointer) item->id);
+
+        if (res->mime) {
+            ids = g_hash_table_lookup (doc->resource_mimes, res->mime);
+            if (!ids) {
+                ids = g_ptr_array_new ();
+                g_hash_table_insert (doc->resource_mimes, res->mime, ids);
+            }
+            g_ptr_array_add (ids, (gpointer) item->id);
+        }
+    }
+}
+
+static gint
+toc_chapter_compare (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    GArray *tree = user_data;
+    guint ia = *(const guint *) a;
+    guint ib = *(const guint *) b;
+    gint ca = g_array_index (tree, GepubTocEntry, ia).chapter;
+    gint cb = g_array_index (tree, GepubTocEntry, ib).chapter;
+
+    if (ca != cb)
+        return ca < cb ? -1 : 1;
+
+    return ia < ib ? -1 : ia > ib;
+}
+
+/* Builds the TOC indices and the public TOC list once the entries are
+ * complete:
+ * the entries pointing to the spine, sorted by chapter,
+ * uri#fragment : entry index + 1,
+ * the top level entries, in play order.
+ */
+static void
+gepub_doc_index_toc (GepubDoc *doc)
+{
+    guint i;
+
+    for (i = 0; i < doc->toc_tree->len; i++) {
+        GepubTocEntry *entry = &g_array_index (doc->toc_tree, GepubTocEntry, i);
+
+        if (entry->content && doc->chapter >= 0)
+            entry->chapter = gepub_doc_resource_uri_to_chapter (doc, entry->content);
+        if (entry->chapter >= 0)
+            g_array_append_val (doc->toc_by_chapter, i);
+
+        if (entry->content && entry->fragment) {
+            g_autofree gchar *key = g_strconcat (entry->content, "#", entry->fragment, NULL);
+            if (!g_hash_table_contains (doc->toc_fragments, key))
+                g_hash_table_insert (doc->toc_fragments, gepub_doc_store (doc, key), GUINT_TO_POINTER (i + 1));
+        }
+
+        if (entry->depth == 0) {
+            GepubNavPoint navpoint = { entry->label, entry->content, entry->playorder };
+            g_array_append_val (doc->toc_entries, navpoint);
+        }
+    }
+
+    g_array_sort_with_data (doc->toc_by_chapter, toc_chapter_compare, doc->toc_tree);
+    g_array_sort (doc->toc_entries, (GCompareFunc) navpoint_compare);
+
+    g_clear_pointer (&doc->toc, g_list_free);
+    for (i = doc->toc_entries->len; i > 0; i--)
+        doc->toc = g_list_prepend (doc->toc, &g_array_index (doc->toc_entries, GepubNavPoint, i - 1));
+}
+
+static void
+gepub_doc_spine_add (GepubDoc *doc, const gchar *id)
+{
+    // a chapter listed twice is found at its first position
+    if (!g_hash_table_contains (doc->spine_index, id))
+        g_hash_table_insert (doc->spine_index, (gpointer) id, GUINT_TO_POINTER (doc->spine->len + 1));
+
+    g_ptr_array_add (doc->spine, (gpointer) id);
+    doc->chapter = 0;
+}
+
+static const gchar *
+gepub_doc_spine_id (GepubDoc *doc, gint chapter)
+{
+    if (chapter < 0 || (guint) chapter >= doc->spine->len)
+        return NULL;
+
+    return g_ptr_array_index (doc->spine, chapter);
 }
 
 static void
@@ -184,6 +534,39 @@ gepub_doc_class_init (GepubDocClass *klass)
                              G_PARAM_READWRITE |
                              G_PARAM_CONSTRUCT_ONLY |
                              G_PARAM_STATIC_STRINGS);
+    properties[PROP_FILE] =
+        g_param_spec_object ("file",
+                             "File",
+                             "The EPUB document file",
+                             G_TYPE_FILE,
+                             G_PARAM_READWRITE |
+                             G_PARAM_CONSTRUCT_ONLY |
+                             G_PARAM_STATIC_STRINGS);
+    properties[PROP_BYTES] =
+        g_param_spec_boxed ("bytes",
+                            "Bytes",
+                            "The EPUB document contents",
+                            G_TYPE_BYTES,
+                            G_PARAM_READWRITE |
+                            G_PARAM_CONSTRUCT_ONLY |
+                            G_PARAM_STATIC_STRINGS);
+    properties[PROP_STREAM] =
+        g_param_spec_object ("stream",
+                             "Stream",
+                             "A seekable stream with the EPUB document contents",
+                             G_TYPE_INPUT_STREAM,
+                             G_PARAM_READWRITE |
+                             G_PARAM_CONSTRUCT_ONLY |
+                             G_PARAM_STATIC_STRINGS);
+    properties[PROP_FLAGS] =
+        g_param_spec_flags ("flags",
+                            "Flags",
+                            "The flags used to open the EPUB document",
+                            GEPUB_TYPE_DOC_OPEN_FLAGS,
+                            GEPUB_DOC_OPEN_NONE,
+                            G_PARAM_READWRITE |
+                            G_PARAM_CONSTRUCT_ONLY |
+                            G_PARAM_STATIC_STRINGS);
     properties[PROP_CHAPTER] =
         g_param_spec_int ("chapter",
                           "Current chapter",
@@ -195,34 +578,412 @@ gepub_doc_class_init (GepubDocClass *klass)
     g_object_class_install_properties (object_class, NUM_PROPS, properties);
 }
 
+static gchar *
+gepub_doc_prefetch_key (const gchar *path)
+{
+    while (path[0] == '/')
+        path++;
+
+    return g_ascii_strdown (path, -1);
+}
+
+/* Reads the container and the package documents in a single pass over
+ * the archive, before we know which one we need.
+ */
+static void
+gepub_doc_prefetch_package (GepubDoc *doc)
+{
+    GList *files, *l;
+    GPtrArray *paths, *entries;
+    guint i;
+
+    paths = g_ptr_array_new ();
+    g_ptr_array_add (paths, "mimetype");
+    g_ptr_array_add (paths, "META-INF/container.xml");
+
+    files = gepub_archive_list_files (doc->archive);
+    for (l = files; l; l = l->next) {
+        g_autofree gchar *key = g_ascii_strdown (l->data, -1);
+
+        if (g_str_has_suffix (key, ".opf"))
+            g_ptr_array_add (paths, l->data);
+    }
+    g_ptr_array_add (paths, NULL);
+
+    entries = gepub_archive_read_entries (doc->archive, (const gchar * const *) paths->pdata);
+
+    doc->prefetched = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                             g_free, (GDestroyNotify) g_bytes_unref);
+    for (i = 0; i < entries->len; i++) {
+        GBytes *bytes = g_ptr_array_index (entries, i);
+
+        if (bytes) {
+            g_hash_table_replace (doc->prefetched,
+                                  gepub_doc_prefetch_key (g_ptr_array_index (paths, i)),
+                                  g_bytes_ref (bytes));
+        }
+    }
+
+    g_ptr_array_unref (entries);
+    g_ptr_array_free (paths, TRUE);
+    g_list_free_full (files, g_free);
+}
+
+static GBytes *
+gepub_doc_read_entry (GepubDoc *doc, const gchar *path)
+{
+    if (doc->prefetched) {
+        g_autofree gchar *key = gepub_doc_prefetch_key (path);
+        GBytes *bytes = g_hash_table_lookup (doc->prefetched, key);
+
+        if (bytes)
+            return g_bytes_ref (bytes);
+    }
+
+    return gepub_archive_read_entry (doc->archive, path);
+}
+
+/* The cache is keyed by the file identity, so any change to the file
+ * invalidates it.
+ */
+static gboolean
+gepub_doc_index_cache_identity (GepubDoc  *doc,
+                                gchar    **path,
+                                guint64   *size,
+                                gint64    *mtime,
+                                guint64   *inode)
+{
+    GFile *file;
+    GStatBuf st;
+
+    if (!doc->path)
+        return FALSE;
+
+    file = g_file_new_for_path (doc->path);
+    *path = g_file_get_path (file);
+    g_object_unref (file);
+
+    if (g_stat (*path, &st) != 0) {
+        g_clear_pointer (path, g_free);
+        return FALSE;
+    }
+
+    *size = st.st_size;
+    *mtime = st.st_mtime;
+    *inode = st.st_ino;
+
+    return TRUE;
+}
+
+static gchar *
+gepub_doc_index_cache_file (const gchar *path)
+{
+    g_autofree gchar *checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, path, -1);
+    g_autofree gchar *name = g_strconcat (checksum, ".index", NULL);
+
+    return g_build_filename (g_get_user_cache_dir (), "libgepub", name, NULL);
+}
+
+/* Restores the package and the TOC from the index cache, without
+ * reading or parsing any XML. The package document itself is read on
+ * demand.
+ */
+static gboolean
+gepub_doc_index_cache_load (GepubDoc *doc)
+{
+    g_autofree gchar *path = NULL;
+    g_autofree gchar *cache_file = NULL;
+    guint64 size, inode;
+    gint64 mtime;
+    GMappedFile *mapped;
+    GBytes *bytes;
+    GVariant *cache, *resources, *spine, *metadata, *toc, *index;
+    GVariantIter iter;
+    guint32 version;
+    const gchar *cache_path, *content_path, *content_base;
+    gchar *cover;
+    gchar **values;
+    guint64 cache_size, cache_inode;
+    gint64 cache_mtime;
+    const gchar *id, *mime, *uri;
+    gchar *name, *nav_id, *toc_id;
+    GepubTocEntry entry;
+    const gchar *label, *content, *fragment;
+    gboolean valid;
+
+    if (!gepub_doc_index_cache_identity (doc, &path, &size, &mtime, &inode))
+        return FALSE;
+
+    cache_file = gepub_doc_index_cache_file (path);
+    mapped = g_mapped_file_new (cache_file, FALSE, NULL);
+    if (!mapped)
+        return FALSE;
+
+    bytes = g_mapped_file_get_bytes (mapped);
+    g_mapped_file_unref (mapped);
+    cache = g_variant_new_from_bytes (G_VARIANT_TYPE (GEPUB_DOC_INDEX_CACHE_TYPE), bytes, FALSE);
+    g_variant_ref_sink (cache);
+    g_bytes_unref (bytes);
+
+    // a truncated or corrupted file reads as zeros, so it doesn't match
+    g_variant_get (cache, "(u&stxt&s&s@a(smss)@asmsms@a{sas}ms@a(msmsmstiii)@"
+                   GEPUB_ARCHIVE_INDEX_TYPE ")",
+                   &version, &cache_path, &cache_size, &cache_mtime, &cache_inode,
+                   &content_path, &content_base, &resources, &spine, &nav_id, &toc_id,
+                   &metadata, &cover, &toc, &index);
+
+    valid = version == GEPUB_DOC_INDEX_CACHE_VERSION &&
+            !g_strcmp0 (cache_path, path) &&
+            cache_size == size && cache_mtime == mtime && cache_inode == inode &&
+            content_path[0] != '\0' &&
+            _gepub_archive_load_index (doc->archive, index);
+
+    if (valid) {
+        doc->content_path = g_strdup (content_path);
+        doc->content_base = g_strdup (content_base);
+
+        g_variant_iter_init (&iter, resources);
+        while (g_variant_iter_next (&iter, "(&sm&s&s)", &id, &mime, &uri))
+            gepub_doc_add_resource (doc, id, mime, uri);
+        gepub_doc_index_resources (doc);
+
+        g_variant_iter_init (&iter, spine);
+        while (g_variant_iter_next (&iter, "&s", &id))
+            gepub_doc_spine_add (doc, gepub_doc_intern (doc, id));
+
+        doc->nav_id = gepub_doc_intern (doc, nav_id);
+        doc->toc_id = gepub_doc_intern (doc, toc_id);
+
+        g_variant_iter_init (&iter, metadata);
+        while (g_variant_iter_next (&iter, "{s^as}", &name, &values))
+            g_hash_table_insert (doc->metadata, name, values);
+
+        doc->cover = g_steal_pointer (&cover);
+
+        // the chapters are looked up again against the restored spine
+        g_variant_iter_init (&iter, toc);
+        while (g_variant_iter_next (&iter, "(m&sm&sm&stiii)", &label, &content, &fragment,
+                                    &entry.playorder, &entry.depth, &entry.parent,
+                                    &entry.chapter)) {
+            entry.label = gepub_doc_store (doc, label);
+            entry.content = gepub_doc_intern (doc, content);
+            entry.fragment = gepub_doc_store (doc, fragment);
+            g_array_append_val (doc->toc_tree, entry);
+        }
+        gepub_doc_index_toc (doc);
+        g_atomic_int_set (&doc->toc_built, TRUE);
+    }
+
+    g_free (cover);
+    g_free (nav_id);
+    g_free (toc_id);
+    g_variant_unref (resources);
+    g_variant_unref (spine);
+    g_variant_unref (metadata);
+    g_variant_unref (toc);
+    g_variant_unref (index);
+    g_variant_unref (cache);
+
+    return valid;
+}
+
+static void
+gepub_doc_index_cache_save (GepubDoc *doc)
+{
+    g_autofree gchar *path = NULL;
+    g_autofree gchar *cache_file = NULL;
+    g_autofree gchar *cache_dir = NULL;
+    guint64 size, inode;
+    gint64 mtime;
+    GVariantBuilder resources, spine, metadata, toc;
+    GVariant *index, *cache;
+    GHashTableIter iter;
+    gpointer id, value;
+    guint i;
+    GError *error = NULL;
+
+    if (!gepub_doc_index_cache_identity (doc, &path, &size, &mtime, &inode))
+        return;
+
+    // archives that can't be indexed are scanned anyway
+    index = _gepub_archive_save_index (doc->archive);
+    if (!index)
+        return;
+
+    // in manifest order, the tables are built again from it
+    g_variant_builder_init (&resources, G_VARIANT_TYPE ("a(smss)"));
+    for (i = 0; i < doc->manifest->len; i++) {
+        GepubManifestItem *item = &g_array_index (doc->manifest, GepubManifestItem, i);
+
+        g_variant_builder_add (&resources, "(smss)", item->id, item->res.mime, item->res.uri);
+    }
+
+    g_variant_builder_init (&spine, G_VARIANT_TYPE ("as"));
+    for (i = 0; i < doc->spine->len; i++)
+        g_variant_builder_add (&spine, "s", g_ptr_array_index (doc->spine, i));
+
+    g_variant_builder_init (&metadata, G_VARIANT_TYPE ("a{sas}"));
+    g_hash_table_iter_init (&iter, doc->metadata);
+    while (g_hash_table_iter_next (&iter, &id, &value))
+        g_variant_builder_add (&metadata, "{s^as}", id, value);
+
+    // parsed once here, so the warm opens don't parse any XML at all
+    gepub_doc_ensure_toc (doc);
+    g_variant_builder_init (&toc, G_VARIANT_TYPE ("a(msmsmstiii)"));
+    for (i = 0; i < doc->toc_tree->len; i++) {
+        GepubTocEntry *entry = &g_array_index (doc->toc_tree, GepubTocEntry, i);
+
+        g_variant_builder_add (&toc, "(msmsmstiii)", entry->label, entry->content,
+                               entry->fragment, entry->playorder, entry->depth,
+                               entry->parent, entry->chapter);
+    }
+
+    cache = g_variant_new ("(ustxtss@a(smss)@asmsms@a{sas}ms@a(msmsmstiii)@"
+                           GEPUB_ARCHIVE_INDEX_TYPE ")",
+                           GEPUB_DOC_INDEX_CACHE_VERSION, path, size, mtime, inode,
+                           doc->content_path, doc->content_base,
+                           g_variant_builder_end (&resources),
+                           g_variant_builder_end (&spine),
+                           doc->nav_id,
+                           doc->toc_id,
+                           g_variant_builder_end (&metadata),
+                           doc->cover,
+                           g_variant_builder_end (&toc),
+                           index);
+    g_variant_ref_sink (cache);
+
+    cache_file = gepub_doc_index_cache_file (path);
+    cache_dir = g_path_get_dirname (cache_file);
+    if (g_mkdir_with_parents (cache_dir, 0700) != 0 ||
+        !g_file_set_contents (cache_file, g_variant_get_data (cache),
+                              g_variant_get_size (cache), &error)) {
+        g_debug ("Can't write the index cache for %s: %s", path,
+                 error ? error->message : g_strerror (errno));
+        g_clear_error (&error);
+    }
+
+    g_variant_unref (cache);
+}
+
+/* The mimetype entry is optional in practice, but when it's there it
+ * tells the ZIP files that aren't epubs apart without parsing any XML.
+ */
+static gboolean
+gepub_doc_check_mimetype (GepubDoc *doc)
+{
+    g_autofree gchar *key = gepub_doc_prefetch_key ("mimetype");
+    GBytes *bytes;
+    const gchar *data;
+    gsize size;
+
+    // read with the package, it's not in the archive if it's not there
+    bytes = g_hash_table_lookup (doc->prefetched, key);
+    if (!bytes)
+        return TRUE;
+
+    data = g_bytes_get_data (bytes, &size);
+    while (size > 0 && g_ascii_isspace (data[size - 1]))
+        size--;
+
+    return size == strlen (GEPUB_MIMETYPE) && !memcmp (data, GEPUB_MIMETYPE, size);
+}
+
+static GBytes *
+gepub_doc_ensure_content (GepubDoc *doc)
+{
+    // restored from the index cache, read on first use by any thread
+    if (g_once_init_enter (&doc->content_once)) {
+        // the memory stats peek at it without waiting
+        if (!doc->content && doc->content_path)
+            g_atomic_pointer_set (&doc->content,
+                                  gepub_archive_read_entry (doc->archive, doc->content_path));
+        g_once_init_leave (&doc->content_once, 1);
+    }
+
+    return doc->content;
+}
+
 static gboolean
 gepub_doc_initable_init (GInitable     *initable,
                          GCancellable  *cancellable,
                          GError       **error)
 {
     GepubDoc *doc = GEPUB_DOC (initable);
-    gchar *file;
+    gchar *file = NULL;
     gint i = 0, len;
+    GBytes *container;
+    gint64 begin;
     g_autofree gchar *unescaped = NULL;
+    g_autofree gchar *name = NULL;
+
+    if (doc->path) {
+        doc->archive = gepub_archive_new (doc->path);
+        name = g_strdup (doc->path);
+    } else if (doc->file) {
+        doc->path = g_file_get_path (doc->file);
+        doc->archive = gepub_archive_new_from_file (doc->file);
+        name = g_file_get_parse_name (doc->file);
+    } else if (doc->bytes) {
+        doc->archive = gepub_archive_new_from_bytes (doc->bytes);
+        name = g_strdup ("(memory)");
+    } else if (doc->stream && G_IS_SEEKABLE (doc->stream) &&
+               g_seekable_can_seek (G_SEEKABLE (doc->stream))) {
+        doc->archive = gepub_archive_new_from_stream (doc->stream);
+        name = g_strdup ("(stream)");
+    } else {
+        if (error != NULL) {
+            g_set_error (error, gepub_error_quark (), GEPUB_ERROR_INVALID,
+                         "No seekable epub source given");
+        }
+        return FALSE;
+    }
 
-    g_assert (doc->path != NULL);
+    // the async init runs this in a worker, check between the slow steps
+    if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        return FALSE;
+
+    if ((doc->flags & GEPUB_DOC_OPEN_INDEX_CACHE) && gepub_doc_index_cache_load (doc))
+        return TRUE;
+
+    gepub_doc_prefetch_package (doc);
+    if (g_cancellable_set_error_if_cancelled (cancellable, error)) {
+        g_clear_pointer (&doc->prefetched, g_hash_table_destroy);
+        return FALSE;
+    }
+
+    if (!gepub_doc_check_mimetype (doc)) {
+        if (error != NULL) {
+            g_set_error (error, gepub_error_quark (), GEPUB_ERROR_INVALID,
+                         "Not an epub file: %s", name);
+        }
+        g_clear_pointer (&doc->prefetched, g_hash_table_destroy);
+        return FALSE;
+    }
 
-    doc->archive = gepub_archive_new (doc->path);
-    file = gepub_archive_get_root_file (doc->archive);
+    // root file is in META-INF/container.xml
+    container = gepub_doc_read_entry (doc, "META-INF/container.xml");
+    if (container) {
+        file = _gepub_utils_get_root_file (container);
+        g_bytes_unref (container);
+    }
     if (!file) {
         if (error != NULL) {
             g_set_error (error, gepub_error_quark (), GEPUB_ERROR_INVALID,
-                         "Invalid epub file: %s", doc->path);
+                         "Invalid epub file: %s", name);
         }
+        g_clear_pointer (&doc->prefetched, g_hash_table_destroy);
         return FALSE;
     }
     unescaped = g_uri_unescape_string (file, NULL);
-    doc->content = gepub_archive_read_entry (doc->archive, unescaped);
+    doc->content_path = g_strdup (unescaped);
+    doc->content = gepub_doc_read_entry (doc, unescaped);
     if (!doc->content) {
         if (error != NULL) {
             g_set_error (error, gepub_error_quark (), GEPUB_ERROR_INVALID,
-                         "Invalid epub file: %s", doc->path);
+                         "Invalid epub file: %s", name);
         }
+        g_clear_pointer (&doc->prefetched, g_hash_table_destroy);
+        g_free (file);
         return FALSE;
     }
 
@@ -236,11 +997,26 @@ gepub_doc_initable_init (GInitable     *initable,
         }
     }
 
-    gepub_doc_fill_resources (doc);
-    gepub_doc_fill_spine (doc);
+    if (g_cancellable_set_error_if_cancelled (cancellable, error)) {
+        g_clear_pointer (&doc->prefetched, g_hash_table_destroy);
+        g_free (file);
+        return FALSE;
+    }
 
+    // the package document is parsed only once, here, in a single pass
+    begin = _gepub_trace_begin ();
+    gepub_doc_parse_package (doc, doc->flags & GEPUB_DOC_OPEN_METADATA_ONLY);
+    _gepub_trace_end (GEPUB_TRACE_PACKAGE_PARSE, begin, file,
+                      g_bytes_get_size (doc->content), doc->strings_size);
+
+    g_clear_pointer (&doc->prefetched, g_hash_table_destroy);
     g_free (file);
 
+    // a partial package would be wrong for the next full open
+    if ((doc->flags & GEPUB_DOC_OPEN_INDEX_CACHE) &&
+        !(doc->flags & GEPUB_DOC_OPEN_METADATA_ONLY))
+        gepub_doc_index_cache_save (doc);
+
     return TRUE;
 }
 
@@ -250,6 +1026,13 @@ gepub_doc_initable_iface_init (GInitableIface *iface)
     iface->init = gepub_doc_initable_init;
 }
 
+static void
+gepub_doc_async_initable_iface_init (GAsyncInitableIface *iface)
+{
+    // the default implementation runs gepub_doc_initable_init() in a
+    // worker thread, the doc isn't shared with anyone until it's done
+}
+
 /**
  * gepub_doc_new:
  * @path: the epub doc path
@@ -266,86 +1049,352 @@ gepub_doc_new (const gchar *path, GError **error)
                            NULL);
 }
 
-static void
-gepub_doc_fill_resources (GepubDoc *doc)
+/**
+ * gepub_doc_new_async:
+ * @path: the epub doc path
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: a #GAsyncReadyCallback to call when the doc is open
+ * @user_data: the data to pass to @callback
+ *
+ * Asynchronously opens the epub doc at @path. The archive is scanned
+ * and the package is parsed in a worker thread, so it doesn't block
+ * the main loop. Use gepub_doc_new_finish() to get the doc.
+ */
+void
+gepub_doc_new_async (const gchar         *path,
+                     GCancellable        *cancellable,
+                     GAsyncReadyCallback  callback,
+                     gpointer             user_data)
 {
-    xmlDoc *xdoc = NULL;
-    xmlNode *root_element = NULL;
-    xmlNode *mnode = NULL;
-    xmlNode *item = NULL;
-    gchar *id, *tmpuri, *uri;
-    GepubResource *res;
-    const char *data;
-    gsize size;
+    g_return_if_fail (path != NULL);
 
-    data = g_bytes_get_data (doc->content, &size);
-    xdoc = xmlRecoverMemory (data, size);
-    root_element = xmlDocGetRootElement (xdoc);
-    mnode = gepub_utils_get_element_by_tag (root_element, "manifest");
+    g_async_initable_new_async (GEPUB_TYPE_DOC, G_PRIORITY_DEFAULT,
+                                cancellable, callback, user_data,
+                                "path", path,
+                                NULL);
+}
 
-    item = mnode->children;
-    while (item) {
-        if (item->type != XML_ELEMENT_NODE ) {
-            item = item->next;
-            continue;
-        }
+/**
+ * gepub_doc_new_finish:
+ * @result: the #GAsyncResult passed to the callback
+ * @error: (nullable): Error
+ *
+ * Finishes an operation started with gepub_doc_new_async().
+ *
+ * Returns: (transfer full): the new GepubDoc created, or %NULL on error
+ */
+GepubDoc *
+gepub_doc_new_finish (GAsyncResult  *result,
+                      GError       **error)
+{
+    GObject *source;
+    GObject *doc;
 
-        id = gepub_utils_get_prop (item, "id");
-        tmpuri = gepub_utils_get_prop (item, "href");
-        uri = g_strdup_printf ("%s%s", doc->content_base, tmpuri);
-        g_free (tmpuri);
+    g_return_val_if_fail (G_IS_ASYNC_RESULT (result), NULL);
 
-        res = g_malloc (sizeof (GepubResource));
-        res->mime = gepub_utils_get_prop (item, "media-type");
-        res->uri = uri;
-        g_hash_table_insert (doc->resources, id, res);
-        item = item->next;
-    }
+    source = g_async_result_get_source_object (result);
+    doc = g_async_initable_new_finish (G_ASYNC_INITABLE (source), result, error);
+    g_object_unref (source);
 
-    xmlFreeDoc (xdoc);
+    return doc ? GEPUB_DOC (doc) : NULL;
 }
 
-static void
-gepub_doc_fill_spine (GepubDoc *doc)
-{
-    xmlDoc *xdoc = NULL;
-    xmlNode *root_element = NULL;
-    xmlNode *snode = NULL;
-    xmlNode *item = NULL;
-    gchar *id;
-    const char *data;
-    gsize size;
-    GList *spine = NULL;
-    gchar *toc = NULL;
+/**
+ * gepub_doc_new_with_flags:
+ * @path: the epub doc path
+ * @flags: the #GepubDocOpenFlags
+ * @error: (nullable): Error
+ *
+ * With %GEPUB_DOC_OPEN_INDEX_CACHE the parsed package is kept in the
+ * user cache directory, so opening the same file again doesn't parse
+ * any XML.
+ *
+ * Returns: (transfer full): the new GepubDoc created
+ */
+GepubDoc *
+gepub_doc_new_with_flags (const gchar        *path,
+                          GepubDocOpenFlags   flags,
+                          GError            **error)
+{
+    return g_initable_new (GEPUB_TYPE_DOC,
+                           NULL, error,
+                           "path", path,
+                           "flags", flags,
+                           NULL);
+}
 
-    data = g_bytes_get_data (doc->content, &size);
-    xdoc = xmlRecoverMemory (data, size);
-    root_element = xmlDocGetRootElement (xdoc);
-    snode = gepub_utils_get_element_by_tag (root_element, "spine");
+/**
+ * gepub_doc_new_from_file:
+ * @file: the epub doc #GFile
+ * @error: (nullable): Error
+ *
+ * Returns: (transfer full): the new GepubDoc created
+ */
+GepubDoc *
+gepub_doc_new_from_file (GFile *file, GError **error)
+{
+    g_return_val_if_fail (G_IS_FILE (file), NULL);
+
+    return g_initable_new (GEPUB_TYPE_DOC,
+                           NULL, error,
+                           "file", file,
+                           NULL);
+}
+
+/**
+ * gepub_doc_new_from_bytes:
+ * @bytes: the epub doc contents
+ * @error: (nullable): Error
+ *
+ * Opens an epub doc that is already in memory, without writing it to
+ * a file first.
+ *
+ * Returns: (transfer full): the new GepubDoc created
+ */
+GepubDoc *
+gepub_doc_new_from_bytes (GBytes *bytes, GError **error)
+{
+    g_return_val_if_fail (bytes != NULL, NULL);
+
+    return g_initable_new (GEPUB_TYPE_DOC,
+                           NULL, error,
+                           "bytes", bytes,
+                           NULL);
+}
+
+/**
+ * gepub_doc_new_from_stream:
+ * @stream: a seekable #GInputStream with the epub doc contents
+ * @error: (nullable): Error
+ *
+ * The doc reads the resources from @stream on demand, so it shouldn't
+ * be used by anybody else while the doc is alive.
+ *
+ * Returns: (transfer full): the new GepubDoc created
+ */
+GepubDoc *
+gepub_doc_new_from_stream (GInputStream *stream, GError **error)
+{
+    g_return_val_if_fail (G_IS_INPUT_STREAM (stream), NULL);
+
+    return g_initable_new (GEPUB_TYPE_DOC,
+                           NULL, error,
+                           "stream", stream,
+                           NULL);
+}
 
-    toc = gepub_utils_get_prop (snode, "toc");
-    if (toc) {
-        gepub_doc_fill_toc (doc, toc);
-        g_free (toc);
+typedef enum {
+    PACKAGE_NONE,
+    PACKAGE_METADATA,
+    PACKAGE_MANIFEST,
+    PACKAGE_SPINE,
+} GepubPackageSection;
+
+static void
+gepub_doc_add_metadata (GHashTable *values, const gchar *name, const gchar *value)
+{
+    GPtrArray *list;
+
+    list = g_hash_table_lookup (values, name);
+    if (!list) {
+        list = g_ptr_array_new ();
+        g_hash_table_insert (values, g_strdup (name), list);
     }
 
-    item = snode->children;
-    while (item) {
-        if (item->type != XML_ELEMENT_NODE ) {
-            item = item->next;
-            continue;
-        }
+    g_ptr_array_add (list, g_strdup (value));
+}
+
+// properties is a space separated list, like the class html attribute
+static gboolean
+gepub_doc_has_property (const gchar *properties, const gchar *property)
+{
+    gchar **props;
+    gboolean found;
+
+    if (!properties)
+        return FALSE;
+
+    props = g_strsplit_set (properties, " \t\n\r", -1);
+    found = g_strv_contains ((const gchar * const *) props, property);
+    g_strfreev (props);
+
+    return found;
+}
+
+static void
+gepub_doc_add_manifest_item (GepubDoc *doc, xmlTextReader *reader)
+{
+    gchar *id, *tmpuri, *uri, *mime, *properties;
+
+    id = _gepub_utils_reader_get_attr (reader, "id");
+    tmpuri = _gepub_utils_reader_get_attr (reader, "href");
+    uri = g_strdup_printf ("%s%s", doc->content_base, tmpuri);
+    mime = _gepub_utils_reader_get_attr (reader, "media-type");
+
+    gepub_doc_add_resource (doc, id, mime, uri);
+
+    // the EPUB 3 navigation document and cover, the EPUB 2 cover meta
+    // comes first if there's one
+    properties = _gepub_utils_reader_get_attr (reader, "properties");
+    if (id && !doc->nav_id && gepub_doc_has_property (properties, "nav"))
+        doc->nav_id = gepub_doc_intern (doc, id);
+    if (id && !doc->cover && gepub_doc_has_property (properties, "cover-image"))
+        doc->cover = g_strdup (id);
+
+    g_free (id);
+    g_free (tmpuri);
+    g_free (uri);
+    g_free (mime);
+    g_free (properties);
+}
+
+static void
+gepub_doc_parse_package (GepubDoc *doc, gboolean metadata_only)
+{
+    xmlTextReader *reader;
+    gboolean stop = FALSE;
+    GepubPackageSection section = PACKAGE_NONE;
+    gint section_depth = 0;
+    // sections already parsed, only the first of each kind is used
+    guint done = 0;
+    // name : GPtrArray of values, in document order
+    GHashTable *values;
+    // the innermost open metadata element, until a child element shows up
+    gchar *leaf = NULL;
+    gint leaf_depth = -1;
+    GString *text;
+    gboolean cover_found = FALSE;
+    GHashTableIter iter;
+    gpointer name, list;
+
+    reader = _gepub_utils_reader_new (doc->content);
+    if (!reader)
+        return;
+
+    values = g_hash_table_new (g_str_hash, g_str_equal);
+    text = g_string_new (NULL);
 
-        id = gepub_utils_get_prop (item, "idref");
+    while (!stop && xmlTextReaderRead (reader) == 1) {
+        gint type = xmlTextReaderNodeType (reader);
+        gint depth = xmlTextReaderDepth (reader);
+        const gchar *tag = (const gchar *) xmlTextReaderConstLocalName (reader);
 
-        spine = g_list_prepend (spine, id);
-        item = item->next;
+        if (type == XML_READER_TYPE_ELEMENT) {
+            gboolean empty = xmlTextReaderIsEmptyElement (reader);
+
+            if (!cover_found) {
+                g_autofree gchar *attr = _gepub_utils_reader_get_attr (reader, "name");
+                if (!g_strcmp0 (attr, "cover")) {
+                    cover_found = TRUE;
+                    doc->cover = _gepub_utils_reader_get_attr (reader, "content");
+                }
+            }
+
+            if (section == PACKAGE_NONE) {
+                if (!g_strcmp0 (tag, "metadata"))
+                    section = PACKAGE_METADATA;
+                else if (!g_strcmp0 (tag, "manifest"))
+                    section = PACKAGE_MANIFEST;
+                else if (!g_strcmp0 (tag, "spine"))
+                    section = PACKAGE_SPINE;
+
+                if (section == PACKAGE_NONE || (done & (1 << section))) {
+                    section = PACKAGE_NONE;
+                    continue;
+                }
+
+                // only the cover is needed from the manifest, and the
+                // metadata always comes first
+                if (metadata_only && section == PACKAGE_SPINE) {
+                    section = PACKAGE_NONE;
+                    continue;
+                }
+
+                section_depth = depth;
+                if (section == PACKAGE_SPINE) {
+                    // parsed by gepub_doc_get_toc()
+                    gchar *toc = _gepub_utils_reader_get_attr (reader, "toc");
+                    doc->toc_id = gepub_doc_intern (doc, toc);
+                    g_free (toc);
+                }
+                if (empty) {
+                    done |= 1 << section;
+                    section = PACKAGE_NONE;
+                }
+                continue;
+            }
+
+            switch (section) {
+            case PACKAGE_MANIFEST:
+                if (depth != section_depth + 1)
+                    break;
+                if (metadata_only) {
+                    g_autofree gchar *id = _gepub_utils_reader_get_attr (reader, "id");
+                    g_autofree gchar *properties = _gepub_utils_reader_get_attr (reader, "properties");
+
+                    // the item named by the cover meta, or the EPUB 3 one
+                    if (doc->cover ? g_strcmp0 (id, doc->cover) != 0 :
+                                     !gepub_doc_has_property (properties, "cover-image"))
+                        break;
+                    stop = TRUE;
+                }
+                gepub_doc_add_manifest_item (doc, reader);
+                break;
+            case PACKAGE_SPINE:
+                if (depth == section_depth + 1) {
+                    gchar *id = _gepub_utils_reader_get_attr (reader, "idref");
+                    if (id)
+                        gepub_doc_spine_add (doc, gepub_doc_intern (doc, id));
+                    g_free (id);
+                }
+                break;
+            case PACKAGE_METADATA:
+                // old packages group the metadata in dc-metadata and
+                // x-metadata, so an element only holds a value if it has
+                // no element children
+                g_free (leaf);
+                leaf = g_strdup (tag);
+                leaf_depth = depth;
+                g_string_truncate (text, 0);
+                if (empty) {
+                    gepub_doc_add_metadata (values, leaf, "");
+                    g_clear_pointer (&leaf, g_free);
+                }
+                break;
+            default:
+                break;
+            }
+        } else if (type == XML_READER_TYPE_END_ELEMENT) {
+            if (leaf && depth == leaf_depth) {
+                gepub_doc_add_metadata (values, leaf, text->str);
+                g_clear_pointer (&leaf, g_free);
+            }
+            if (section != PACKAGE_NONE && depth == section_depth) {
+                if (metadata_only && section == PACKAGE_MANIFEST)
+                    stop = TRUE;
+                done |= 1 << section;
+                section = PACKAGE_NONE;
+            }
+        } else if (leaf && (type == XML_READER_TYPE_TEXT ||
+                            type == XML_READER_TYPE_CDATA ||
+                            type == XML_READER_TYPE_WHITESPACE ||
+                            type == XML_READER_TYPE_SIGNIFICANT_WHITESPACE)) {
+            g_string_append (text, (const gchar *) xmlTextReaderConstValue (reader));
+        }
     }
 
-    doc->spine = g_list_reverse (spine);
-    doc->chapter = doc->spine;
+    g_hash_table_iter_init (&iter, values);
+    while (g_hash_table_iter_next (&iter, &name, &list)) {
+        g_ptr_array_add (list, NULL);
+        g_hash_table_insert (doc->metadata, name, g_ptr_array_free (list, FALSE));
+    }
+    g_hash_table_destroy (values);
 
-    xmlFreeDoc (xdoc);
+    g_free (leaf);
+    g_string_free (text, TRUE);
+    xmlFreeTextReader (reader);
+
+    gepub_doc_index_resources (doc);
 }
 
 static gint
@@ -355,95 +1404,734 @@ navpoint_compare (GepubNavPoint *a, GepubNavPoint *b)
 }
 
 static void
-gepub_doc_fill_toc (GepubDoc *doc, gchar *toc_id)
+gepub_doc_ensure_toc (GepubDoc *doc)
 {
-    xmlDoc *xdoc = NULL;
-    xmlNode *root_element = NULL;
-    xmlNode *mapnode = NULL;
-    xmlNode *item = NULL;
-    const char *data;
-    gsize size;
-    GList *toc = NULL;
-    GBytes *toc_data = NULL;
+    if (g_atomic_int_get (&doc->toc_built))
+        return;
+
+    g_mutex_lock (&doc->toc_lock);
+    if (!doc->toc_built) {
+        gepub_doc_fill_toc (doc);
+        g_atomic_int_set (&doc->toc_built, TRUE);
+    }
+    g_mutex_unlock (&doc->toc_lock);
+}
+
+/* Resolves a TOC link against the uri of the document containing it,
+ * dropping the "." and ".." segments, so it matches the manifest uris.
+ */
+static gchar *
+gepub_doc_resolve_href (const gchar *doc_uri, const gchar *href)
+{
+    g_autofree gchar *scheme = NULL;
+    g_autofree gchar *dir = NULL;
+    g_autofree gchar *path = NULL;
+    gchar **segments;
+    GPtrArray *parts;
+    gchar *resolved;
+    guint i;
+
+    if (href[0] == '\0')
+        return g_strdup (doc_uri);
+
+    // external links are kept as they are
+    scheme = g_uri_parse_scheme (href);
+    if (scheme)
+        return g_strdup (href);
+
+    if (href[0] == '/') {
+        path = g_strdup (href + 1);
+    } else {
+        const gchar *slash = strrchr (doc_uri, '/');
+        dir = slash ? g_strndup (doc_uri, slash - doc_uri + 1) : g_strdup ("");
+        path = g_strconcat (dir, href, NULL);
+    }
+
+    segments = g_strsplit (path, "/", -1);
+    parts = g_ptr_array_new ();
+    for (i = 0; segments[i]; i++) {
+        if (!strcmp (segments[i], ".") || (segments[i][0] == '\0' && segments[i + 1]))
+            continue;
+        if (!strcmp (segments[i], "..")) {
+            if (parts->len)
+                g_ptr_array_remove_index (parts, parts->len - 1);
+            continue;
+        }
+        g_ptr_array_add (parts, segments[i]);
+    }
+    g_ptr_array_add (parts, NULL);
+
+    resolved = g_strjoinv ("/", (gchar **) parts->pdata);
 
-    doc->toc = toc;
+    g_ptr_array_free (parts, TRUE);
+    g_strfreev (segments);
 
-    toc_data = gepub_doc_get_resource_by_id (doc, toc_id);
+    return resolved;
+}
+
+/* Adds an entry under the innermost open one, and opens it. */
+static guint
+gepub_doc_toc_push (GepubDoc *doc, GArray *open, guint64 playorder)
+{
+    GepubTocEntry entry = { NULL, NULL, NULL, 0, 0, -1, -1 };
+    guint idx = doc->toc_tree->len;
+
+    entry.playorder = playorder;
+    entry.depth = open->len;
+    if (open->len)
+        entry.parent = g_array_index (open, guint, open->len - 1);
+
+    g_array_append_val (doc->toc_tree, entry);
+    g_array_append_val (open, idx);
+
+    return idx;
+}
+
+static void
+gepub_doc_toc_set_target (GepubDoc    *doc,
+                          guint        idx,
+                          const gchar *doc_uri,
+                          const gchar *href)
+{
+    GepubTocEntry *entry = &g_array_index (doc->toc_tree, GepubTocEntry, idx);
+    gchar **split;
+    gchar *uri;
+
+    split = g_strsplit (href ? href : "", "#", 2);
+
+    uri = gepub_doc_resolve_href (doc_uri, split[0] ? split[0] : "");
+    entry->content = gepub_doc_intern (doc, uri);
+    if (split[0] && split[1] && split[1][0])
+        entry->fragment = gepub_doc_store (doc, split[1]);
+
+    g_free (uri);
+    g_strfreev (split);
+}
+
+static GBytes *
+gepub_doc_read_toc_document (GepubDoc *doc, const gchar *id, const gchar **uri)
+{
+    GepubResource *res;
+    g_autofree gchar *unescaped = NULL;
+
+    res = g_hash_table_lookup (doc->resources, id);
+    if (!res || !res->uri) {
+        return NULL;
+    }
+
+    *uri = res->uri;
+    unescaped = g_uri_unescape_string (res->uri, NULL);
+    return gepub_archive_read_entry (doc->archive, unescaped);
+}
+
+static void
+gepub_doc_parse_ncx (GepubDoc *doc, const gchar *toc_id)
+{
+    xmlTextReader *reader;
+    GBytes *toc_data = NULL;
+    const gchar *toc_uri = NULL;
+    GArray *open;
+    GString *label;
+    gint map_depth = -1;
+    gint text_depth = -1;
+    // the navPoint whose label is being read, and if it's already set
+    gint label_owner = -1;
+    gboolean label_done = FALSE;
+    gint64 begin;
+
+    toc_data = gepub_doc_read_toc_document (doc, toc_id, &toc_uri);
     if (!toc_data) {
         return;
     }
+    begin = _gepub_trace_begin ();
 
-    data = g_bytes_get_data (toc_data, &size);
-    xdoc = xmlRecoverMemory (data, size);
-    root_element = xmlDocGetRootElement (xdoc);
-    mapnode = gepub_utils_get_element_by_tag (root_element, "navMap");
+    reader = _gepub_utils_reader_new (toc_data);
+    if (!reader) {
+        g_bytes_unref (toc_data);
+        return;
+    }
 
-    // TODO: get docTitle
-    // TODO: parse metadata (dtb:totalPageCount, dtb:depth, dtb:maxPageNumber)
+    // the head metadata and the docTitle aren't exposed, everything
+    // before the navMap is skipped
 
-    item = mapnode->children;
-    while (item) {
-        GepubNavPoint *navpoint = NULL;
-        gchar *order;
-        xmlNode *navchilds = NULL;
+    open = g_array_new (FALSE, FALSE, sizeof (guint));
+    label = g_string_new (NULL);
 
-        if (item->type != XML_ELEMENT_NODE ||
-            g_strcmp0 ((const gchar *)item->name, "navPoint")) {
-            item = item->next;
-            continue;
-        }
+    // nested navPoints are flattened in document order, each one with
+    // its navLabel->text and content children
+    while (xmlTextReaderRead (reader) == 1) {
+        gint type = xmlTextReaderNodeType (reader);
+        gint depth = xmlTextReaderDepth (reader);
+        const gchar *tag = (const gchar *) xmlTextReaderConstLocalName (reader);
 
-        navpoint = g_malloc0 (sizeof (GepubNavPoint));
+        if (type == XML_READER_TYPE_ELEMENT) {
+            gboolean empty = xmlTextReaderIsEmptyElement (reader);
+            guint current;
 
-        order = gepub_utils_get_prop (item, "playOrder");
-        if (order) {
-            g_ascii_string_to_unsigned (order, 10, 0, INT_MAX,
-                                        &navpoint->playorder, NULL);
-            g_free (order);
-        }
+            if (map_depth < 0) {
+                if (!g_strcmp0 (tag, "navMap")) {
+                    if (empty)
+                        break;
+                    map_depth = depth;
+                }
+                continue;
+            }
+
+            if (!g_strcmp0 (tag, "navPoint")) {
+                guint64 playorder = 0;
+                gchar *order;
 
-        // parsing navPoint->navLabel->text and navPoint->content
-        navchilds = item->children;
-        while (navchilds) {
-            if (item->type != XML_ELEMENT_NODE) {
-                navchilds = navchilds->next;
+                order = _gepub_utils_reader_get_attr (reader, "playOrder");
+                if (order) {
+                    g_ascii_string_to_unsigned (order, 10, 0, INT_MAX,
+                                                &playorder, NULL);
+                    g_free (order);
+                }
+
+                gepub_doc_toc_push (doc, open, playorder);
+                label_owner = -1;
+                label_done = FALSE;
+                if (empty)
+                    g_array_set_size (open, open->len - 1);
                 continue;
             }
 
-            if (!g_strcmp0 ((const gchar *)navchilds->name, "content")) {
-                gchar **split;
-                gchar *tmpuri;
-                tmpuri = gepub_utils_get_prop (navchilds, "src");
-                // removing # params. Maybe we should store the # params in the
-                // navpoint to use in the future if the doc references to a position
-                // inside the chapter
-                split = g_strsplit (tmpuri, "#", -1);
+            if (!open->len)
+                continue;
+            current = g_array_index (open, guint, open->len - 1);
+
+            if (!g_strcmp0 (tag, "content") &&
+                depth == map_depth + (gint) open->len + 1) {
+                gchar *src = _gepub_utils_reader_get_attr (reader, "src");
+                gepub_doc_toc_set_target (doc, current, toc_uri, src);
+                g_free (src);
+            } else if (!g_strcmp0 (tag, "navLabel") &&
+                       depth == map_depth + (gint) open->len + 1) {
+                if (label_owner != (gint) current)
+                    label_done = FALSE;
+                label_owner = current;
+            } else if (!g_strcmp0 (tag, "text") && label_owner == (gint) current &&
+                       !label_done) {
+                // the first text of the label
+                label_done = TRUE;
+                g_string_truncate (label, 0);
+                if (!empty)
+                    text_depth = depth;
+            }
+        } else if (type == XML_READER_TYPE_END_ELEMENT) {
+            if (depth == text_depth) {
+                GepubTocEntry *entry = &g_array_index (doc->toc_tree, GepubTocEntry, label_owner);
+                entry->label = gepub_doc_store (doc, label->str);
+                text_depth = -1;
+            }
+            if (!g_strcmp0 (tag, "navPoint") && open->len) {
+                g_array_set_size (open, open->len - 1);
+                label_owner = -1;
+            }
+            if (depth == map_depth)
+                break;
+        } else if (text_depth >= 0 && (type == XML_READER_TYPE_TEXT ||
+                                       type == XML_READER_TYPE_CDATA)) {
+            g_string_append (label, (const gchar *) xmlTextReaderConstValue (reader));
+        }
+    }
+
+    g_string_free (label, TRUE);
+    g_array_unref (open);
+    xmlFreeTextReader (reader);
+
+    _gepub_trace_end (GEPUB_TRACE_TOC_PARSE, begin, toc_uri, g_bytes_get_size (toc_data),
+                      doc->toc_tree->len * sizeof (GepubTocEntry));
+    g_bytes_unref (toc_data);
+}
 
-                // adding the base path
-                navpoint->content = g_strdup_printf ("%s%s", doc->content_base, split[0]);
+static void
+gepub_doc_parse_nav (GepubDoc *doc, const gchar *nav_id)
+{
+    xmlTextReader *reader;
+    GBytes *nav_data = NULL;
+    const gchar *nav_uri = NULL;
+    GArray *open;
+    GString *label;
+    gint nav_depth = -1;
+    gint label_depth = -1;
+    // the li whose label is being read, and if it's already set
+    gint label_owner = -1;
+    gboolean label_done = FALSE;
+    gint64 begin;
+
+    nav_data = gepub_doc_read_toc_document (doc, nav_id, &nav_uri);
+    if (!nav_data) {
+        return;
+    }
+    begin = _gepub_trace_begin ();
 
-                g_strfreev (split);
-                g_free (tmpuri);
+    reader = _gepub_utils_reader_new (nav_data);
+    if (!reader) {
+        g_bytes_unref (nav_data);
+        return;
+    }
+
+    open = g_array_new (FALSE, FALSE, sizeof (guint));
+    label = g_string_new (NULL);
+
+    // <nav epub:type="toc"><ol><li><a href="...">label</a><ol>...
+    while (xmlTextReaderRead (reader) == 1) {
+        gint type = xmlTextReaderNodeType (reader);
+        gint depth = xmlTextReaderDepth (reader);
+        const gchar *tag = (const gchar *) xmlTextReaderConstLocalName (reader);
+
+        if (type == XML_READER_TYPE_ELEMENT) {
+            gboolean empty = xmlTextReaderIsEmptyElement (reader);
+
+            if (nav_depth < 0) {
+                if (!g_strcmp0 (tag, "nav") && !empty) {
+                    g_autofree gchar *kind = _gepub_utils_reader_get_attr (reader, "epub:type");
+                    gchar **kinds = g_strsplit_set (kind ? kind : "", " \t\n\r", -1);
+
+                    if (g_strv_contains ((const gchar * const *) kinds, "toc"))
+                        nav_depth = depth;
+                    g_strfreev (kinds);
+                }
+                continue;
+            }
+
+            if (!g_strcmp0 (tag, "li")) {
+                // the play order is the reading order of the nav document
+                gepub_doc_toc_push (doc, open, doc->toc_tree->len + 1);
+                label_done = FALSE;
+                if (empty)
+                    g_array_set_size (open, open->len - 1);
+                continue;
             }
 
-            if (!g_strcmp0 ((const gchar *)navchilds->name, "navLabel")) {
-                xmlNode *text = gepub_utils_get_element_by_tag (navchilds, "text");
-                if (text->children && text->children->type == XML_TEXT_NODE) {
-                  navpoint->label = g_strdup ((gchar *)text->children->content);
+            if (!open->len)
+                continue;
+
+            if (label_depth < 0 && !label_done &&
+                (!g_strcmp0 (tag, "a") || !g_strcmp0 (tag, "span"))) {
+                label_owner = g_array_index (open, guint, open->len - 1);
+                label_done = TRUE;
+                g_string_truncate (label, 0);
+
+                if (!g_strcmp0 (tag, "a")) {
+                    gchar *href = _gepub_utils_reader_get_attr (reader, "href");
+                    if (href)
+                        gepub_doc_toc_set_target (doc, label_owner, nav_uri, href);
+                    g_free (href);
                 }
+
+                if (empty) {
+                    GepubTocEntry *entry = &g_array_index (doc->toc_tree, GepubTocEntry, label_owner);
+                    entry->label = gepub_doc_store (doc, "");
+                } else {
+                    label_depth = depth;
+                }
+            }
+        } else if (type == XML_READER_TYPE_END_ELEMENT) {
+            if (depth == label_depth) {
+                GepubTocEntry *entry = &g_array_index (doc->toc_tree, GepubTocEntry, label_owner);
+                gchar *text = g_strstrip (g_strdup (label->str));
+
+                entry->label = gepub_doc_store (doc, text);
+                g_free (text);
+                label_depth = -1;
+            }
+            if (!g_strcmp0 (tag, "li") && open->len) {
+                g_array_set_size (open, open->len - 1);
+                // the rest of the parent li is not part of its label
+                label_done = TRUE;
             }
+            if (depth == nav_depth)
+                break;
+        } else if (label_depth >= 0 && (type == XML_READER_TYPE_TEXT ||
+                                        type == XML_READER_TYPE_CDATA ||
+                                        type == XML_READER_TYPE_WHITESPACE ||
+                                        type == XML_READER_TYPE_SIGNIFICANT_WHITESPACE)) {
+            g_string_append (label, (const gchar *) xmlTextReaderConstValue (reader));
+        }
+    }
+
+    g_string_free (label, TRUE);
+    g_array_unref (open);
+    xmlFreeTextReader (reader);
+
+    _gepub_trace_end (GEPUB_TRACE_TOC_PARSE, begin, nav_uri, g_bytes_get_size (nav_data),
+                      doc->toc_tree->len * sizeof (GepubTocEntry));
+    g_bytes_unref (nav_data);
+}
+
+static void
+gepub_doc_fill_toc (GepubDoc *doc)
+{
+    // the EPUB 3 nav document first, the NCX is kept for compatibility
+    if (doc->nav_id)
+        gepub_doc_parse_nav (doc, doc->nav_id);
+    if (!doc->toc_tree->len && doc->toc_id)
+        gepub_doc_parse_ncx (doc, doc->toc_id);
+
+    gepub_doc_index_toc (doc);
+}
+
+/**
+ * gepub_doc_set_cache_size:
+ * @doc: a #GepubDoc
+ * @max_size: the cache budget in bytes, 0 to disable the cache
+ *
+ * Keeps up to @max_size bytes of inflated resources in memory, so
+ * stylesheets and fonts shared by every chapter are only inflated once.
+ * See gepub_archive_set_cache_size().
+ */
+void
+gepub_doc_set_cache_size (GepubDoc *doc, gsize max_size)
+{
+    g_return_if_fail (GEPUB_IS_DOC (doc));
+
+    gepub_archive_set_cache_size (doc->archive, max_size);
+}
+
+/**
+ * gepub_doc_get_cache_stats:
+ * @doc: a #GepubDoc
+ * @hits: (out) (optional): return location for the number of cache hits
+ * @misses: (out) (optional): return location for the number of cache misses
+ * @size: (out) (optional): return location for the bytes held by the cache
+ *
+ * Gets the resource cache counters.
+ */
+void
+gepub_doc_get_cache_stats (GepubDoc *doc,
+                           guint64  *hits,
+                           guint64  *misses,
+                           gsize    *size)
+{
+    g_return_if_fail (GEPUB_IS_DOC (doc));
+
+    gepub_archive_get_cache_stats (doc->archive, hits, misses, size);
+}
+
+typedef struct {
+    GepubReadahead *readahead;
+    GepubArchive *archive;
+    GPtrArray *ids;
+    GPtrArray *paths;
+} GepubReadaheadJob;
+
+static void
+gepub_readahead_job_free (GepubReadaheadJob *job)
+{
+    gepub_readahead_unref (job->readahead);
+    g_object_unref (job->archive);
+    g_ptr_array_free (job->ids, TRUE);
+    g_ptr_array_free (job->paths, TRUE);
+    g_free (job);
+}
+
+static void
+gepub_doc_readahead_thread (GTask        *task,
+                            gpointer      source_object,
+                            gpointer      task_data,
+                            GCancellable *cancellable)
+{
+    GepubReadaheadJob *job = task_data;
+    GepubReadahead *readahead = job->readahead;
+    guint i;
+
+    for (i = 0; i < job->ids->len; i++) {
+        const gchar *id = g_ptr_array_index (job->ids, i);
+        const gchar *path = g_ptr_array_index (job->paths, i);
+        g_autofree gchar *unescaped = NULL;
+        g_autofree gchar *base = NULL;
+        GBytes *content, *replaced;
+        gboolean cached;
+
+        if (g_cancellable_is_cancelled (cancellable))
+            break;
+
+        g_mutex_lock (&readahead->lock);
+        cached = g_hash_table_contains (readahead->chapters, id);
+        g_mutex_unlock (&readahead->lock);
+        if (cached)
+            continue;
+
+        unescaped = g_uri_unescape_string (path, NULL);
+        content = gepub_archive_read_entry (job->archive, unescaped);
+        if (!content)
+            continue;
 
-            navchilds = navchilds->next;
+        base = g_path_get_dirname (path);
+        replaced = gepub_utils_replace_resources (content, base);
+        g_bytes_unref (content);
+
+        // the doc cancels before pruning the cache under the same lock,
+        // so a cancelled job never leaves a chapter out of the window
+        g_mutex_lock (&readahead->lock);
+        if (!g_cancellable_is_cancelled (cancellable))
+            g_hash_table_replace (readahead->chapters, g_strdup (id), g_bytes_ref (replaced));
+        g_mutex_unlock (&readahead->lock);
+
+        g_bytes_unref (replaced);
+    }
+
+    g_task_return_boolean (task, TRUE);
+}
+
+static void
+gepub_doc_readahead_add (GepubDoc          *doc,
+                         GepubReadaheadJob *job,
+                         GHashTable        *window,
+                         const gchar       *id)
+{
+    GepubResource *res;
+
+    g_hash_table_add (window, (gpointer) id);
+
+    res = g_hash_table_lookup (doc->resources, id);
+    if (!res)
+        return;
+
+    g_ptr_array_add (job->ids, g_strdup (id));
+    g_ptr_array_add (job->paths, g_strdup (res->uri));
+}
+
+/* Drops the chapters that are no longer around the current one and
+ * starts a worker for the ones that should be ready next.
+ */
+// Returns: (transfer full) (nullable): the read-ahead state
+static GepubReadahead *
+gepub_doc_readahead_get (GepubDoc *doc)
+{
+    GepubReadahead *readahead = NULL;
+
+    g_mutex_lock (&doc->readahead_lock);
+    if (doc->readahead)
+        readahead = gepub_readahead_ref (doc->readahead);
+    g_mutex_unlock (&doc->readahead_lock);
+
+    return readahead;
+}
+
+static void
+gepub_doc_readahead_set (GepubDoc *doc, GepubReadahead *readahead)
+{
+    GepubReadahead *old;
+
+    g_mutex_lock (&doc->readahead_lock);
+    old = doc->readahead;
+    doc->readahead = readahead;
+    g_mutex_unlock (&doc->readahead_lock);
+
+    if (old)
+        gepub_readahead_unref (old);
+}
+
+static void
+gepub_doc_readahead_schedule (GepubDoc *doc)
+{
+    GepubReadahead *readahead;
+    GepubReadaheadJob *job;
+    GHashTable *window;
+    GHashTableIter iter;
+    gpointer id;
+    GTask *task;
+    guint i;
+
+    if (doc->readahead_cancellable) {
+        g_cancellable_cancel (doc->readahead_cancellable);
+        g_clear_object (&doc->readahead_cancellable);
+    }
+
+    if (doc->chapter < 0 || !(readahead = gepub_doc_readahead_get (doc)))
+        return;
+
+    job = g_new0 (GepubReadaheadJob, 1);
+    job->ids = g_ptr_array_new_with_free_func (g_free);
+    job->paths = g_ptr_array_new_with_free_func (g_free);
+
+    // the current chapter stays in the cache, but it's already being
+    // loaded by the caller, so the worker only looks at its neighbours
+    window = g_hash_table_new (g_str_hash, g_str_equal);
+    g_hash_table_add (window, (gpointer) gepub_doc_spine_id (doc, doc->chapter));
+
+    for (i = 1; i <= doc->readahead_ahead && doc->chapter + i < doc->spine->len; i++)
+        gepub_doc_readahead_add (doc, job, window, gepub_doc_spine_id (doc, doc->chapter + i));
+    for (i = 1; i <= doc->readahead_behind && i <= (guint) doc->chapter; i++)
+        gepub_doc_readahead_add (doc, job, window, gepub_doc_spine_id (doc, doc->chapter - i));
+
+    g_mutex_lock (&readahead->lock);
+    g_hash_table_iter_init (&iter, readahead->chapters);
+    while (g_hash_table_iter_next (&iter, &id, NULL)) {
+        if (!g_hash_table_contains (window, id))
+            g_hash_table_iter_remove (&iter);
+    }
+    g_mutex_unlock (&readahead->lock);
+
+    g_hash_table_unref (window);
+
+    if (!job->ids->len) {
+        g_ptr_array_free (job->ids, TRUE);
+        g_ptr_array_free (job->paths, TRUE);
+        g_free (job);
+        gepub_readahead_unref (readahead);
+        return;
+    }
+
+    job->readahead = readahead;
+    job->archive = g_object_ref (doc->archive);
+
+    doc->readahead_cancellable = g_cancellable_new ();
+    task = g_task_new (NULL, doc->readahead_cancellable, NULL, NULL);
+    g_task_set_task_data (task, job, (GDestroyNotify) gepub_readahead_job_free);
+    g_task_run_in_thread (task, gepub_doc_readahead_thread);
+    g_object_unref (task);
+}
+
+static GBytes *
+gepub_doc_readahead_lookup (GepubDoc *doc, gint chapter)
+{
+    GepubReadahead *readahead;
+    GBytes *replaced;
+
+    if (chapter < 0 || !(readahead = gepub_doc_readahead_get (doc)))
+        return NULL;
+
+    g_mutex_lock (&readahead->lock);
+    replaced = g_hash_table_lookup (readahead->chapters, gepub_doc_spine_id (doc, chapter));
+    if (replaced)
+        g_bytes_ref (replaced);
+    g_mutex_unlock (&readahead->lock);
+
+    gepub_readahead_unref (readahead);
+
+    return replaced;
+}
+
+/**
+ * gepub_doc_set_readahead:
+ * @doc: a #GepubDoc
+ * @ahead: the number of chapters to prepare after the current one
+ * @behind: the number of chapters to prepare before the current one
+ *
+ * Each time the current chapter changes, the next @ahead and the
+ * previous @behind chapters are inflated and rewritten in a worker
+ * thread, so gepub_doc_get_current_with_epub_uris() doesn't have to
+ * do it when the reader gets there. Jumping to another chapter cancels
+ * the pending work. Use 0 for both to disable the read-ahead.
+ */
+void
+gepub_doc_set_readahead (GepubDoc *doc,
+                         guint     ahead,
+                         guint     behind)
+{
+    g_return_if_fail (GEPUB_IS_DOC (doc));
+
+    doc->readahead_ahead = ahead;
+    doc->readahead_behind = behind;
+
+    if (!ahead && !behind) {
+        if (doc->readahead_cancellable) {
+            g_cancellable_cancel (doc->readahead_cancellable);
+            g_clear_object (&doc->readahead_cancellable);
         }
+        gepub_doc_readahead_set (doc, NULL);
+        return;
+    }
+
+    if (!doc->readahead)
+        gepub_doc_readahead_set (doc, gepub_readahead_new ());
+
+    gepub_doc_readahead_schedule (doc);
+}
+
+// a hash table node: key, value and hash
+#define GEPUB_TABLE_SLOT_SIZE (2 * sizeof (gpointer) + sizeof (guint))
 
-        toc = g_list_prepend (toc, navpoint);
-        item = item->next;
+static gsize
+gepub_doc_table_size (GHashTable *table)
+{
+    return g_hash_table_size (table) * GEPUB_TABLE_SLOT_SIZE;
+}
+
+/**
+ * gepub_doc_get_memory_stats:
+ * @doc: a #GepubDoc
+ * @stats: (out caller-allocates): return location for the stats
+ *
+ * Gets how much memory @doc holds, per subsystem. Nothing is loaded to
+ * measure it, so the TOC counts as empty until it's been read. The
+ * numbers are estimates from the sizes of the stored elements.
+ */
+void
+gepub_doc_get_memory_stats (GepubDoc         *doc,
+                            GepubMemoryStats *stats)
+{
+    GepubReadahead *readahead;
+    GHashTableIter iter;
+    gpointer key, value;
+    GBytes *content;
+    guint i;
+
+    g_return_if_fail (GEPUB_IS_DOC (doc));
+    g_return_if_fail (stats != NULL);
+
+    memset (stats, 0, sizeof (GepubMemoryStats));
+
+    if ((content = g_atomic_pointer_get (&doc->content)))
+        stats->package = g_bytes_get_size (content);
+
+    // a TOC build on another thread adds strings and fills the tables
+    g_mutex_lock (&doc->toc_lock);
+    stats->strings = doc->strings_size + gepub_doc_table_size (doc->interned);
+    if (doc->toc_built) {
+        stats->toc = doc->toc_tree->len * sizeof (GepubTocEntry) +
+                     doc->toc_by_chapter->len * sizeof (guint) +
+                     gepub_doc_table_size (doc->toc_fragments) +
+                     doc->toc_entries->len * (sizeof (GepubNavPoint) + sizeof (GList));
+        stats->n_toc_entries = doc->toc_tree->len;
+    }
+    g_mutex_unlock (&doc->toc_lock);
+
+    stats->resources = doc->manifest->len * sizeof (GepubManifestItem) +
+                       gepub_doc_table_size (doc->resources) +
+                       gepub_doc_table_size (doc->resource_uris) +
+                       gepub_doc_table_size (doc->resource_mimes);
+    g_hash_table_iter_init (&iter, doc->resource_mimes);
+    while (g_hash_table_iter_next (&iter, NULL, &value))
+        stats->resources += ((GPtrArray *) value)->len * sizeof (gpointer);
+    stats->n_resources = g_hash_table_size (doc->resources);
+
+    stats->spine = doc->spine->len * sizeof (gpointer) +
+                   gepub_doc_table_size (doc->spine_index);
+    stats->n_chapters = doc->spine->len;
+
+    g_hash_table_iter_init (&iter, doc->metadata);
+    while (g_hash_table_iter_next (&iter, &key, &value)) {
+        gchar **values = value;
+
+        stats->metadata += strlen (key) + 1 + GEPUB_TABLE_SLOT_SIZE;
+        for (i = 0; values[i]; i++)
+            stats->metadata += strlen (values[i]) + 1 + sizeof (gchar *);
+        stats->metadata += sizeof (gchar *);
     }
 
-    doc->toc = g_list_sort (toc, (GCompareFunc) navpoint_compare);
+    stats->archive_index = _gepub_archive_get_index_size (doc->archive);
+    gepub_archive_get_cache_stats (doc->archive, NULL, NULL, &stats->archive_cache);
 
-    xmlFreeDoc (xdoc);
-    g_bytes_unref (toc_data);
+    if ((readahead = gepub_doc_readahead_get (doc))) {
+        g_mutex_lock (&readahead->lock);
+        g_hash_table_iter_init (&iter, readahead->chapters);
+        while (g_hash_table_iter_next (&iter, &key, &value)) {
+            stats->readahead += strlen (key) + 1 + GEPUB_TABLE_SLOT_SIZE +
+                                g_bytes_get_size (value);
+        }
+        g_mutex_unlock (&readahead->lock);
+        gepub_readahead_unref (readahead);
+    }
+
+    stats->total = stats->package + stats->strings + stats->resources +
+                   stats->spine + stats->toc + stats->metadata +
+                   stats->archive_index + stats->archive_cache +
+                   stats->readahead;
 }
 
 /**
@@ -457,7 +2145,7 @@ gepub_doc_get_content (GepubDoc *doc)
 {
     g_return_val_if_fail (GEPUB_IS_DOC (doc), NULL);
 
-    return doc->content;
+    return gepub_doc_ensure_content (doc);
 }
 
 /**
@@ -470,31 +2158,36 @@ gepub_doc_get_content (GepubDoc *doc)
 gchar *
 gepub_doc_get_metadata (GepubDoc *doc, const gchar *mdata)
 {
-    xmlDoc *xdoc = NULL;
-    xmlNode *root_element = NULL;
-    xmlNode *mnode = NULL;
-    xmlNode *mdata_node = NULL;
-    gchar *ret;
-    xmlChar *text;
-    const char *data;
-    gsize size;
+    gchar **values;
 
     g_return_val_if_fail (GEPUB_IS_DOC (doc), NULL);
     g_return_val_if_fail (mdata != NULL, NULL);
 
-    data = g_bytes_get_data (doc->content, &size);
-    xdoc = xmlRecoverMemory (data, size);
-    root_element = xmlDocGetRootElement (xdoc);
-    mnode = gepub_utils_get_element_by_tag (root_element, "metadata");
-    mdata_node = gepub_utils_get_element_by_tag (mnode, mdata);
+    values = g_hash_table_lookup (doc->metadata, mdata);
+    if (!values) {
+        // not found
+        return NULL;
+    }
 
-    text = xmlNodeGetContent (mdata_node);
-    ret = g_strdup ((const char *) text);
-    xmlFree (text);
+    return g_strdup (values[0]);
+}
 
-    xmlFreeDoc (xdoc);
+/**
+ * gepub_doc_get_all_metadata:
+ * @doc: a #GepubDoc
+ *
+ * Gets every metadata element of the package at once, keyed by the
+ * element name without the namespace prefix, "creator" for example.
+ * Repeated elements keep all their values, in document order.
+ *
+ * Returns: (element-type utf8 GStrv) (transfer none): doc metadata table
+ */
+GHashTable *
+gepub_doc_get_all_metadata (GepubDoc *doc)
+{
+    g_return_val_if_fail (GEPUB_IS_DOC (doc), NULL);
 
-    return ret;
+    return doc->metadata;
 }
 
 /**
@@ -537,26 +2230,197 @@ gepub_doc_get_resource_by_id (GepubDoc *doc, const gchar *id)
     return gepub_archive_read_entry (doc->archive, unescaped);
 }
 
+static void
+gepub_doc_read_thread (GTask        *task,
+                       gpointer      source_object,
+                       gpointer      task_data,
+                       GCancellable *cancellable)
+{
+    GepubDoc *doc = source_object;
+    const gchar *path = task_data;
+    GBytes *bytes;
+
+    if (g_task_return_error_if_cancelled (task))
+        return;
+
+    bytes = gepub_archive_read_entry (doc->archive, path);
+    if (!bytes) {
+        g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                                 "Resource not found: %s", path);
+        return;
+    }
+
+    g_task_return_pointer (task, bytes, (GDestroyNotify) g_bytes_unref);
+}
+
+/* Resolves the resource id in the calling thread, so the worker only
+ * needs the archive. Returns %NULL if the task already failed.
+ */
+static gchar *
+gepub_doc_task_resource_path (GTask       *task,
+                              GepubDoc    *doc,
+                              const gchar *id)
+{
+    GepubResource *gres;
+
+    gres = g_hash_table_lookup (doc->resources, id);
+    if (!gres) {
+        g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                                 "Resource not found: %s", id);
+        return NULL;
+    }
+
+    return g_strdup (gres->uri);
+}
+
+/**
+ * gepub_doc_get_resource_by_id_async:
+ * @doc: a #GepubDoc
+ * @id: the resource id
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: a #GAsyncReadyCallback to call when the resource is read
+ * @user_data: the data to pass to @callback
+ *
+ * Reads the resource in a worker thread. See
+ * gepub_doc_get_resource_by_id().
+ */
+void
+gepub_doc_get_resource_by_id_async (GepubDoc            *doc,
+                                    const gchar         *id,
+                                    GCancellable        *cancellable,
+                                    GAsyncReadyCallback  callback,
+                                    gpointer             user_data)
+{
+    GTask *task;
+    gchar *path;
+
+    g_return_if_fail (GEPUB_IS_DOC (doc));
+    g_return_if_fail (id != NULL);
+
+    task = g_task_new (doc, cancellable, callback, user_data);
+    g_task_set_source_tag (task, gepub_doc_get_resource_by_id_async);
+
+    path = gepub_doc_task_resource_path (task, doc, id);
+    if (path) {
+        g_task_set_task_data (task, g_uri_unescape_string (path, NULL), g_free);
+        g_task_run_in_thread (task, gepub_doc_read_thread);
+        g_free (path);
+    }
+
+    g_object_unref (task);
+}
+
+/**
+ * gepub_doc_get_resource_by_id_finish:
+ * @doc: a #GepubDoc
+ * @result: the #GAsyncResult passed to the callback
+ * @error: (nullable): Error
+ *
+ * Returns: (transfer full): the resource content, or %NULL on error
+ */
+GBytes *
+gepub_doc_get_resource_by_id_finish (GepubDoc      *doc,
+                                     GAsyncResult  *result,
+                                     GError       **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, doc), NULL);
+
+    return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/**
+ * gepub_doc_get_resource:
+ * @doc: a #GepubDoc
+ * @path: the resource path
+ *
+ * Returns: (transfer full): the resource content
+ */
+GBytes *
+gepub_doc_get_resource (GepubDoc *doc, const gchar *path)
+{
+    g_autofree gchar *unescaped = NULL;
+
+    g_return_val_if_fail (GEPUB_IS_DOC (doc), NULL);
+    g_return_val_if_fail (path != NULL, NULL);
+
+    // we need to decode the path because we can get URL encoded paths
+    // like "some%20text.jpg"
+    unescaped = g_uri_unescape_string (path, NULL);
+
+    return gepub_archive_read_entry (doc->archive, unescaped);
+}
+
+/**
+ * gepub_doc_get_resource_async:
+ * @doc: a #GepubDoc
+ * @path: the resource path
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: a #GAsyncReadyCallback to call when the resource is read
+ * @user_data: the data to pass to @callback
+ *
+ * Reads the resource in a worker thread. See gepub_doc_get_resource().
+ */
+void
+gepub_doc_get_resource_async (GepubDoc            *doc,
+                              const gchar         *path,
+                              GCancellable        *cancellable,
+                              GAsyncReadyCallback  callback,
+                              gpointer             user_data)
+{
+    GTask *task;
+
+    g_return_if_fail (GEPUB_IS_DOC (doc));
+    g_return_if_fail (path != NULL);
+
+    task = g_task_new (doc, cancellable, callback, user_data);
+    g_task_set_source_tag (task, gepub_doc_get_resource_async);
+    g_task_set_task_data (task, g_uri_unescape_string (path, NULL), g_free);
+    g_task_run_in_thread (task, gepub_doc_read_thread);
+    g_object_unref (task);
+}
+
+/**
+ * gepub_doc_get_resource_finish:
+ * @doc: a #GepubDoc
+ * @result: the #GAsyncResult passed to the callback
+ * @error: (nullable): Error
+ *
+ * Returns: (transfer full): the resource content, or %NULL on error
+ */
+GBytes *
+gepub_doc_get_resource_finish (GepubDoc      *doc,
+                               GAsyncResult  *result,
+                               GError       **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, doc), NULL);
+
+    return g_task_propagate_pointer (G_TASK (result), error);
+}
+
 /**
- * gepub_doc_get_resource:
+ * gepub_doc_open_resource_stream:
  * @doc: a #GepubDoc
  * @path: the resource path
+ * @size: (out) (optional): return location for the resource size
  *
- * Returns: (transfer full): the resource content
+ * Like gepub_doc_get_resource() but the resource is inflated while
+ * it's read, so big audio or video files aren't loaded in memory.
+ *
+ * Returns: (transfer full) (nullable): a #GInputStream with the resource content
  */
-GBytes *
-gepub_doc_get_resource (GepubDoc *doc, const gchar *path)
+GInputStream *
+gepub_doc_open_resource_stream (GepubDoc    *doc,
+                                const gchar *path,
+                                gint64      *size)
 {
     g_autofree gchar *unescaped = NULL;
 
     g_return_val_if_fail (GEPUB_IS_DOC (doc), NULL);
     g_return_val_if_fail (path != NULL, NULL);
 
-    // we need to decode the path because we can get URL encoded paths
-    // like "some%20text.jpg"
     unescaped = g_uri_unescape_string (path, NULL);
 
-    return gepub_archive_read_entry (doc->archive, unescaped);
+    return gepub_archive_open_entry_stream (doc->archive, unescaped, size);
 }
 
 /**
@@ -593,8 +2457,7 @@ gepub_doc_get_resource_mime_by_id (GepubDoc *doc, const gchar *id)
 gchar *
 gepub_doc_get_resource_mime (GepubDoc *doc, const gchar *path)
 {
-    GepubResource *gres;
-    GList *keys;
+    const gchar *id;
     const gchar *_path;
 
     g_return_val_if_fail (GEPUB_IS_DOC (doc), NULL);
@@ -607,19 +2470,57 @@ gepub_doc_get_resource_mime (GepubDoc *doc, const gchar *path)
         _path = path;
     }
 
-    keys = g_hash_table_get_keys (doc->resources);
+    id = g_hash_table_lookup (doc->resource_uris, _path);
+    if (!id) {
+        // not found
+        return NULL;
+    }
+
+    return gepub_doc_get_resource_mime_by_id (doc, id);
+}
 
-    while (keys) {
-        gres = ((GepubResource*)g_hash_table_lookup (doc->resources, keys->data));
-        if (!strcmp (gres->uri, _path))
-            break;
-        keys = keys->next;
+/**
+ * gepub_doc_get_resources_by_mime:
+ * @doc: a #GepubDoc
+ * @mime: a mime type, like "image/png", or a whole type, like "image/*"
+ *
+ * Returns: (element-type utf8) (transfer container): the ids of the
+ * resources with that mime type
+ */
+GList *
+gepub_doc_get_resources_by_mime (GepubDoc *doc, const gchar *mime)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+    GPtrArray *ids;
+    GList *list = NULL;
+    gsize len;
+    guint i;
+
+    g_return_val_if_fail (GEPUB_IS_DOC (doc), NULL);
+    g_return_val_if_fail (mime != NULL, NULL);
+
+    len = strlen (mime);
+    if (len < 2 || mime[len - 1] != '*' || mime[len - 2] != '/') {
+        ids = g_hash_table_lookup (doc->resource_mimes, mime);
+        for (i = 0; ids && i < ids->len; i++)
+            list = g_list_prepend (list, g_ptr_array_index (ids, i));
+
+        return g_list_reverse (list);
     }
 
-    if (keys)
-        return g_strdup (gres->mime);
-    else
-        return NULL;
+    // "image/*" matches every mime starting with "image/"
+    g_hash_table_iter_init (&iter, doc->resource_mimes);
+    while (g_hash_table_iter_next (&iter, &key, &value)) {
+        if (strncmp (key, mime, len - 1))
+            continue;
+
+        ids = value;
+        for (i = 0; i < ids->len; i++)
+            list = g_list_prepend (list, g_ptr_array_index (ids, i));
+    }
+
+    return g_list_reverse (list);
 }
 
 /**
@@ -632,9 +2533,9 @@ gchar *
 gepub_doc_get_current_mime (GepubDoc *doc)
 {
     g_return_val_if_fail (GEPUB_IS_DOC (doc), NULL);
-    g_return_val_if_fail (doc->chapter != NULL, NULL);
+    g_return_val_if_fail (doc->chapter >= 0, NULL);
 
-    return gepub_doc_get_resource_mime_by_id (doc, doc->chapter->data);
+    return gepub_doc_get_resource_mime_by_id (doc, gepub_doc_spine_id (doc, doc->chapter));
 }
 
 /**
@@ -647,9 +2548,9 @@ GBytes *
 gepub_doc_get_current (GepubDoc *doc)
 {
     g_return_val_if_fail (GEPUB_IS_DOC (doc), NULL);
-    g_return_val_if_fail (doc->chapter != NULL, NULL);
+    g_return_val_if_fail (doc->chapter >= 0, NULL);
 
-    return gepub_doc_get_resource_by_id (doc, doc->chapter->data);
+    return gepub_doc_get_resource_by_id (doc, gepub_doc_spine_id (doc, doc->chapter));
 }
 
 /**
@@ -662,15 +2563,48 @@ gepub_doc_get_current (GepubDoc *doc)
  */
 GBytes *
 gepub_doc_get_current_with_epub_uris (GepubDoc *doc)
+{
+    g_return_val_if_fail (GEPUB_IS_DOC (doc), NULL);
+
+    return gepub_doc_get_chapter_with_epub_uris (doc, doc->chapter);
+}
+
+/**
+ * gepub_doc_get_chapter_with_epub_uris:
+ * @doc: a #GepubDoc
+ * @chapter: a spine index
+ *
+ * Like gepub_doc_get_current_with_epub_uris(), for any chapter. It
+ * doesn't change the doc, so it can be called from any thread.
+ *
+ * Returns: (transfer full): the chapter data, with resource uris renamed
+ * so they have the epub:/// prefix and all are relative to the root file
+ */
+GBytes *
+gepub_doc_get_chapter_with_epub_uris (GepubDoc *doc,
+                                      gint      chapter)
 {
     GBytes *content, *replaced;
+    const gchar *id;
     gchar *path, *base;
 
     g_return_val_if_fail (GEPUB_IS_DOC (doc), NULL);
+    g_return_val_if_fail (chapter >= 0 && (guint) chapter < doc->spine->len, NULL);
+
+    replaced = gepub_doc_readahead_lookup (doc, chapter);
+    if (replaced)
+        return replaced;
+
+    id = gepub_doc_spine_id (doc, chapter);
+    content = gepub_doc_get_resource_by_id (doc, id);
+    path = gepub_doc_get_resource_path (doc, id);
+    if (!content || !path) {
+        g_clear_pointer (&content, g_bytes_unref);
+        g_free (path);
+        return NULL;
+    }
 
-    content = gepub_doc_get_current (doc);
-    path = gepub_doc_get_current_path (doc);
-    // getting the basepath of the current xhtml loaded
+    // getting the basepath of the chapter xhtml
     base = g_path_get_dirname (path);
 
     replaced = gepub_utils_replace_resources (content, base);
@@ -682,6 +2616,174 @@ gepub_doc_get_current_with_epub_uris (GepubDoc *doc)
     return replaced;
 }
 
+static void
+gepub_doc_current_with_epub_uris_thread (GTask        *task,
+                                         gpointer      source_object,
+                                         gpointer      task_data,
+                                         GCancellable *cancellable)
+{
+    GepubDoc *doc = source_object;
+    const gchar *path = task_data;
+    g_autofree gchar *unescaped = NULL;
+    g_autofree gchar *base = NULL;
+    GBytes *content, *replaced;
+
+    if (g_task_return_error_if_cancelled (task))
+        return;
+
+    unescaped = g_uri_unescape_string (path, NULL);
+    content = gepub_archive_read_entry (doc->archive, unescaped);
+    if (!content) {
+        g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                                 "Resource not found: %s", path);
+        return;
+    }
+
+    if (g_task_return_error_if_cancelled (task)) {
+        g_bytes_unref (content);
+        return;
+    }
+
+    base = g_path_get_dirname (path);
+    replaced = gepub_utils_replace_resources (content, base);
+    g_bytes_unref (content);
+
+    g_task_return_pointer (task, replaced, (GDestroyNotify) g_bytes_unref);
+}
+
+/**
+ * gepub_doc_get_current_with_epub_uris_async:
+ * @doc: a #GepubDoc
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: a #GAsyncReadyCallback to call when the chapter is ready
+ * @user_data: the data to pass to @callback
+ *
+ * Reads and rewrites the current chapter in a worker thread. The
+ * chapter is picked when this is called, so changing the chapter later
+ * doesn't change the result; cancel @cancellable to drop it. See
+ * gepub_doc_get_current_with_epub_uris().
+ */
+void
+gepub_doc_get_current_with_epub_uris_async (GepubDoc            *doc,
+                                            GCancellable        *cancellable,
+                                            GAsyncReadyCallback  callback,
+                                            gpointer             user_data)
+{
+    g_return_if_fail (GEPUB_IS_DOC (doc));
+    g_return_if_fail (doc->chapter >= 0);
+
+    gepub_doc_get_chapter_with_epub_uris_async (doc, doc->chapter, cancellable,
+                                                callback, user_data);
+}
+
+/**
+ * gepub_doc_get_chapter_with_epub_uris_async:
+ * @doc: a #GepubDoc
+ * @chapter: a spine index
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: a #GAsyncReadyCallback to call when the chapter is ready
+ * @user_data: the data to pass to @callback
+ *
+ * Reads and rewrites a chapter in a worker thread. See
+ * gepub_doc_get_chapter_with_epub_uris().
+ */
+void
+gepub_doc_get_chapter_with_epub_uris_async (GepubDoc            *doc,
+                                            gint                 chapter,
+                                            GCancellable        *cancellable,
+                                            GAsyncReadyCallback  callback,
+                                            gpointer             user_data)
+{
+    GTask *task;
+    GBytes *replaced;
+    gchar *path;
+
+    g_return_if_fail (GEPUB_IS_DOC (doc));
+    g_return_if_fail (chapter >= 0 && (guint) chapter < doc->spine->len);
+
+    task = g_task_new (doc, cancellable, callback, user_data);
+    g_task_set_source_tag (task, gepub_doc_get_chapter_with_epub_uris_async);
+
+    replaced = gepub_doc_readahead_lookup (doc, chapter);
+    if (replaced) {
+        g_task_return_pointer (task, replaced, (GDestroyNotify) g_bytes_unref);
+    } else {
+        path = gepub_doc_task_resource_path (task, doc, gepub_doc_spine_id (doc, chapter));
+        if (path) {
+            g_task_set_task_data (task, path, g_free);
+            g_task_run_in_thread (task, gepub_doc_current_with_epub_uris_thread);
+        }
+    }
+
+    g_object_unref (task);
+}
+
+/**
+ * gepub_doc_get_current_with_epub_uris_finish:
+ * @doc: a #GepubDoc
+ * @result: the #GAsyncResult passed to the callback
+ * @error: (nullable): Error
+ *
+ * Returns: (transfer full): the chapter data with the epub:/// uris,
+ * or %NULL on error
+ */
+GBytes *
+gepub_doc_get_current_with_epub_uris_finish (GepubDoc      *doc,
+                                             GAsyncResult  *result,
+                                             GError       **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, doc), NULL);
+
+    return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/**
+ * gepub_doc_get_chapter_with_epub_uris_finish:
+ * @doc: a #GepubDoc
+ * @result: the #GAsyncResult passed to the callback
+ * @error: (nullable): Error
+ *
+ * Returns: (transfer full): the chapter data with the epub:/// uris,
+ * or %NULL on error
+ */
+GBytes *
+gepub_doc_get_chapter_with_epub_uris_finish (GepubDoc      *doc,
+                                             GAsyncResult  *result,
+                                             GError       **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, doc), NULL);
+
+    return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static GList *
+gepub_doc_parse_text (GBytes *contents, const gchar *path)
+{
+    xmlDoc *xdoc = NULL;
+    xmlNode *root_element = NULL;
+    const gchar *data;
+    gsize size, text_size = 0;
+    GList *texts, *l;
+    gint64 begin = _gepub_trace_begin ();
+
+    data = g_bytes_get_data (contents, &size);
+    xdoc = htmlReadMemory (data, size, "", NULL, HTML_PARSE_NOWARNING | HTML_PARSE_NOERROR);
+    root_element = xmlDocGetRootElement (xdoc);
+    texts = gepub_utils_get_text_elements (root_element);
+
+    xmlFreeDoc (xdoc);
+
+    for (l = texts; l; l = l->next) {
+        const gchar *text = gepub_text_chunk_text (l->data);
+
+        if (text)
+            text_size += strlen (text);
+    }
+    _gepub_trace_end (GEPUB_TRACE_TEXT_EXTRACT, begin, path, size, text_size);
+
+    return texts;
+}
+
 /**
  * gepub_doc_get_text:
  * @doc: a #GepubDoc
@@ -691,12 +2793,7 @@ gepub_doc_get_current_with_epub_uris (GepubDoc *doc)
 GList *
 gepub_doc_get_text (GepubDoc *doc)
 {
-    xmlDoc *xdoc = NULL;
-    xmlNode *root_element = NULL;
     GBytes *current;
-    const gchar *data;
-    gsize size;
-
     GList *texts = NULL;
 
     g_return_val_if_fail (GEPUB_IS_DOC (doc), NULL);
@@ -705,13 +2802,9 @@ gepub_doc_get_text (GepubDoc *doc)
     if (!current) {
         return NULL;
     }
-    data = g_bytes_get_data (current, &size);
-    xdoc = htmlReadMemory (data, size, "", NULL, HTML_PARSE_NOWARNING | HTML_PARSE_NOERROR);
-    root_element = xmlDocGetRootElement (xdoc);
-    texts = gepub_utils_get_text_elements (root_element);
+    texts = gepub_doc_parse_text (current, gepub_doc_get_current_id (doc));
 
     g_bytes_unref (current);
-    xmlFreeDoc (xdoc);
 
     return texts;
 }
@@ -726,12 +2819,7 @@ gepub_doc_get_text (GepubDoc *doc)
 GList *
 gepub_doc_get_text_by_id (GepubDoc *doc, const gchar *id)
 {
-    xmlDoc *xdoc = NULL;
-    xmlNode *root_element = NULL;
-    gsize size;
-    const gchar *res;
     GBytes *contents;
-
     GList *texts = NULL;
 
     g_return_val_if_fail (GEPUB_IS_DOC (doc), NULL);
@@ -741,26 +2829,111 @@ gepub_doc_get_text_by_id (GepubDoc *doc, const gchar *id)
     if (!contents) {
         return NULL;
     }
-
-    res = g_bytes_get_data (contents, &size);
-    xdoc = htmlReadMemory (res, size, "", NULL, HTML_PARSE_NOWARNING | HTML_PARSE_NOERROR);
-    root_element = xmlDocGetRootElement (xdoc);
-    texts = gepub_utils_get_text_elements (root_element);
+    texts = gepub_doc_parse_text (contents, id);
 
     g_bytes_unref (contents);
-    xmlFreeDoc (xdoc);
 
     return texts;
 }
 
+static void
+gepub_doc_text_free (GList *texts)
+{
+    g_list_free_full (texts, g_object_unref);
+}
+
+static void
+gepub_doc_text_thread (GTask        *task,
+                       gpointer      source_object,
+                       gpointer      task_data,
+                       GCancellable *cancellable)
+{
+    GepubDoc *doc = source_object;
+    const gchar *path = task_data;
+    GBytes *contents;
+    GList *texts;
+
+    if (g_task_return_error_if_cancelled (task))
+        return;
+
+    contents = gepub_archive_read_entry (doc->archive, path);
+    if (!contents) {
+        g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                                 "Resource not found: %s", path);
+        return;
+    }
+
+    texts = gepub_doc_parse_text (contents, path);
+    g_bytes_unref (contents);
+
+    g_task_return_pointer (task, texts, (GDestroyNotify) gepub_doc_text_free);
+}
+
+/**
+ * gepub_doc_get_text_by_id_async:
+ * @doc: a #GepubDoc
+ * @id: the resource id
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: a #GAsyncReadyCallback to call when the text is ready
+ * @user_data: the data to pass to @callback
+ *
+ * Reads and parses the resource in a worker thread. See
+ * gepub_doc_get_text_by_id().
+ */
+void
+gepub_doc_get_text_by_id_async (GepubDoc            *doc,
+                                const gchar         *id,
+                                GCancellable        *cancellable,
+                                GAsyncReadyCallback  callback,
+                                gpointer             user_data)
+{
+    GTask *task;
+    gchar *path;
+
+    g_return_if_fail (GEPUB_IS_DOC (doc));
+    g_return_if_fail (id != NULL);
+
+    task = g_task_new (doc, cancellable, callback, user_data);
+    g_task_set_source_tag (task, gepub_doc_get_text_by_id_async);
+
+    path = gepub_doc_task_resource_path (task, doc, id);
+    if (path) {
+        g_task_set_task_data (task, g_uri_unescape_string (path, NULL), g_free);
+        g_task_run_in_thread (task, gepub_doc_text_thread);
+        g_free (path);
+    }
+
+    g_object_unref (task);
+}
+
+/**
+ * gepub_doc_get_text_by_id_finish:
+ * @doc: a #GepubDoc
+ * @result: the #GAsyncResult passed to the callback
+ * @error: (nullable): Error
+ *
+ * Returns: (element-type Gepub.TextChunk) (transfer full): the list of
+ * text in the resource, or %NULL on error
+ */
+GList *
+gepub_doc_get_text_by_id_finish (GepubDoc      *doc,
+                                 GAsyncResult  *result,
+                                 GError       **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, doc), NULL);
+
+    return g_task_propagate_pointer (G_TASK (result), error);
+}
+
 static gboolean
 gepub_doc_set_chapter_internal (GepubDoc *doc,
-                                GList    *chapter)
+                                gint      chapter)
 {
-    if (!chapter || doc->chapter == chapter)
+    if (chapter < 0 || (guint) chapter >= doc->spine->len || doc->chapter == chapter)
         return FALSE;
 
     doc->chapter = chapter;
+    gepub_doc_readahead_schedule (doc);
     g_object_notify_by_pspec (G_OBJECT (doc), properties[PROP_CHAPTER]);
 
     return TRUE;
@@ -776,9 +2949,9 @@ gboolean
 gepub_doc_go_next (GepubDoc *doc)
 {
     g_return_val_if_fail (GEPUB_IS_DOC (doc), FALSE);
-    g_return_val_if_fail (doc->chapter != NULL, FALSE);
+    g_return_val_if_fail (doc->chapter >= 0, FALSE);
 
-    return gepub_doc_set_chapter_internal (doc, doc->chapter->next);
+    return gepub_doc_set_chapter_internal (doc, doc->chapter + 1);
 }
 
 /**
@@ -791,9 +2964,9 @@ gboolean
 gepub_doc_go_prev (GepubDoc *doc)
 {
     g_return_val_if_fail (GEPUB_IS_DOC (doc), FALSE);
-    g_return_val_if_fail (doc->chapter != NULL, FALSE);
+    g_return_val_if_fail (doc->chapter >= 0, FALSE);
 
-    return gepub_doc_set_chapter_internal (doc, doc->chapter->prev);
+    return gepub_doc_set_chapter_internal (doc, doc->chapter - 1);
 }
 
 /**
@@ -807,7 +2980,7 @@ gepub_doc_get_n_chapters (GepubDoc *doc)
 {
     g_return_val_if_fail (GEPUB_IS_DOC (doc), 0);
 
-    return g_list_length (doc->spine);
+    return doc->spine->len;
 }
 
 /**
@@ -820,10 +2993,9 @@ int
 gepub_doc_get_chapter (GepubDoc *doc)
 {
     g_return_val_if_fail (GEPUB_IS_DOC (doc), 0);
-    g_return_val_if_fail (doc->spine != NULL, 0);
-    g_return_val_if_fail (doc->chapter != NULL, 0);
+    g_return_val_if_fail (doc->chapter >= 0, 0);
 
-    return g_list_position (doc->spine, doc->chapter);
+    return doc->chapter;
 }
 
 /**
@@ -837,14 +3009,11 @@ void
 gepub_doc_set_chapter (GepubDoc *doc,
                     gint      index)
 {
-    GList *chapter;
-
     g_return_if_fail (GEPUB_IS_DOC (doc));
 
     g_return_if_fail (index >= 0 && index <= gepub_doc_get_n_chapters (doc));
 
-    chapter = g_list_nth (doc->spine, index);
-    gepub_doc_set_chapter_internal (doc, chapter);
+    gepub_doc_set_chapter_internal (doc, index);
 }
 
 /**
@@ -857,25 +3026,9 @@ gepub_doc_set_chapter (GepubDoc *doc,
 gchar *
 gepub_doc_get_cover (GepubDoc *doc)
 {
-    xmlDoc *xdoc = NULL;
-    xmlNode *root_element = NULL;
-    xmlNode *mnode = NULL;
-    gchar *ret;
-    const char *data;
-    gsize size;
-
     g_return_val_if_fail (GEPUB_IS_DOC (doc), NULL);
-    g_return_val_if_fail (doc->content != NULL, NULL);
 
-    data = g_bytes_get_data (doc->content, &size);
-    xdoc = xmlRecoverMemory (data, size);
-    root_element = xmlDocGetRootElement (xdoc);
-    mnode = gepub_utils_get_element_by_attr (root_element, "name", "cover");
-    ret = gepub_utils_get_prop (mnode, "content");
-
-    xmlFreeDoc (xdoc);
-
-    return ret;
+    return g_strdup (doc->cover);
 }
 
 /**
@@ -912,9 +3065,9 @@ gchar *
 gepub_doc_get_current_path (GepubDoc *doc)
 {
     g_return_val_if_fail (GEPUB_IS_DOC (doc), NULL);
-    g_return_val_if_fail (doc->chapter != NULL, NULL);
+    g_return_val_if_fail (doc->chapter >= 0, NULL);
 
-    return gepub_doc_get_resource_path (doc, doc->chapter->data);
+    return gepub_doc_get_resource_path (doc, gepub_doc_spine_id (doc, doc->chapter));
 }
 
 /**
@@ -928,9 +3081,26 @@ const gchar *
 gepub_doc_get_current_id (GepubDoc *doc)
 {
     g_return_val_if_fail (GEPUB_IS_DOC (doc), NULL);
-    g_return_val_if_fail (doc->chapter != NULL, NULL);
+    g_return_val_if_fail (doc->chapter >= 0, NULL);
+
+    return gepub_doc_spine_id (doc, doc->chapter);
+}
+
+/**
+ * gepub_doc_get_chapter_id:
+ * @doc: a #GepubDoc
+ * @chapter: a spine index
+ *
+ * Returns: (transfer none): the resource id of @chapter
+ */
+const gchar *
+gepub_doc_get_chapter_id (GepubDoc *doc,
+                          gint      chapter)
+{
+    g_return_val_if_fail (GEPUB_IS_DOC (doc), NULL);
+    g_return_val_if_fail (chapter >= 0 && (guint) chapter < doc->spine->len, NULL);
 
-    return doc->chapter->data;
+    return gepub_doc_spine_id (doc, chapter);
 }
 
 /**
@@ -944,9 +3114,102 @@ GList *
 gepub_doc_get_toc (GepubDoc *doc)
 {
     g_return_val_if_fail (GEPUB_IS_DOC (doc), NULL);
+
+    gepub_doc_ensure_toc (doc);
+
     return doc->toc;
 }
 
+/**
+ * gepub_doc_get_toc_entries:
+ * @doc: a #GepubDoc
+ * @n_entries: (out): the number of entries
+ *
+ * Gets the whole table of contents, from the EPUB 3 navigation document
+ * or from the NCX, flattened in document order. The parent of an entry
+ * always comes before it.
+ *
+ * Returns: (array length=n_entries) (transfer none): the TOC entries
+ */
+const GepubTocEntry *
+gepub_doc_get_toc_entries (GepubDoc *doc,
+                           guint    *n_entries)
+{
+    g_return_val_if_fail (GEPUB_IS_DOC (doc), NULL);
+    g_return_val_if_fail (n_entries != NULL, NULL);
+
+    gepub_doc_ensure_toc (doc);
+
+    *n_entries = doc->toc_tree->len;
+    return (const GepubTocEntry *) doc->toc_tree->data;
+}
+
+/**
+ * gepub_doc_find_toc_entry:
+ * @doc: a #GepubDoc
+ * @chapter: a spine index
+ * @fragment: (nullable): a fragment inside the chapter
+ *
+ * Finds the TOC entry that contains a reading position, to show where
+ * the reader is. If @fragment is the target of an entry in @chapter,
+ * that entry is returned. Otherwise it's the first entry of @chapter,
+ * or the last entry of a previous chapter.
+ *
+ * Returns: the index in gepub_doc_get_toc_entries(), or -1 if there's
+ * no entry before the position
+ */
+gint
+gepub_doc_find_toc_entry (GepubDoc    *doc,
+                          gint         chapter,
+                          const gchar *fragment)
+{
+    guint lo, hi;
+
+    g_return_val_if_fail (GEPUB_IS_DOC (doc), -1);
+
+    gepub_doc_ensure_toc (doc);
+
+    if (chapter < 0)
+        return -1;
+
+    if (fragment && chapter < (gint) doc->spine->len) {
+        GepubResource *res = g_hash_table_lookup (doc->resources, gepub_doc_spine_id (doc, chapter));
+
+        if (res && res->uri) {
+            g_autofree gchar *key = g_strconcat (res->uri, "#", fragment, NULL);
+            guint idx = GPOINTER_TO_UINT (g_hash_table_lookup (doc->toc_fragments, key));
+
+            if (idx)
+                return idx - 1;
+        }
+    }
+
+    // the first entry with a chapter >= @chapter
+    lo = 0;
+    hi = doc->toc_by_chapter->len;
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+        guint idx = g_array_index (doc->toc_by_chapter, guint, mid);
+
+        if (g_array_index (doc->toc_tree, GepubTocEntry, idx).chapter < chapter)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo < doc->toc_by_chapter->len) {
+        guint idx = g_array_index (doc->toc_by_chapter, guint, lo);
+
+        if (g_array_index (doc->toc_tree, GepubTocEntry, idx).chapter == chapter)
+            return idx;
+    }
+
+    if (lo == 0)
+        return -1;
+
+    return g_array_index (doc->toc_by_chapter, guint, lo - 1);
+}
+
 /**
  * gepub_doc_resource_uri_to_chapter:
  * @doc: a #GepubDoc
@@ -963,10 +3226,7 @@ gint
 gepub_doc_resource_uri_to_chapter (GepubDoc *doc,
                                    const gchar *uri)
 {
-    GHashTableIter iter;
-    gchar *key;
-    GepubResource *res;
-    gchar *id = NULL;
+    const gchar *id;
     const gchar *_uri;
 
     if (uri[0] == '/') {
@@ -977,16 +3237,9 @@ gepub_doc_resource_uri_to_chapter (GepubDoc *doc,
     }
 
     g_return_val_if_fail (GEPUB_IS_DOC (doc), -1);
-    g_return_val_if_fail (doc->spine != NULL, -1);
-
-    g_hash_table_iter_init (&iter, doc->resources);
-    while (g_hash_table_iter_next (&iter, (gpointer *)&key, (gpointer *)&res)) {
-        if (!g_strcmp0 (res->uri, _uri)) {
-            id = key;
-            break;
-        }
-    }
+    g_return_val_if_fail (doc->chapter >= 0, -1);
 
+    id = g_hash_table_lookup (doc->resource_uris, _uri);
     if (!id) {
         return -1;
     }
@@ -1010,21 +3263,11 @@ gint
 gepub_doc_resource_id_to_chapter (GepubDoc *doc,
                                   const gchar *id)
 {
-    GList *spine;
-    gint chapter = 0;
-
     g_return_val_if_fail (GEPUB_IS_DOC (doc), -1);
-    g_return_val_if_fail (doc->spine != NULL, -1);
-
-    spine = g_list_first (doc->spine);
-    while (spine && spine->data) {
-        if (!g_strcmp0 (spine->data, id)) {
-            return chapter;
-        }
-        chapter++;
-        spine = spine->next;
-    }
+    g_return_val_if_fail (id != NULL, -1);
+    g_return_val_if_fail (doc->chapter >= 0, -1);
 
-    return -1;
+    // 0 if it's not in the spine
+    return GPOINTER_TO_INT (g_hash_table_lookup (doc->spine_index, id)) - 1;
 }
 
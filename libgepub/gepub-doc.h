@@ -21,6 +21,7 @@
 #define __GEPUB_DOC_H__
 
 #include <glib-object.h>
+#include <gio/gio.h>
 #include <glib.h>
 
 G_BEGIN_DECLS
@@ -46,28 +47,167 @@ struct _GepubNavPoint {
     guint64 playorder;
 };
 
+/**
+ * GepubTocEntry:
+ * @label: the entry title
+ * @content: the resource path the entry points to, without the fragment
+ * @fragment: the fragment inside @content, or %NULL
+ * @playorder: the NCX play order, or the position in the nav document
+ * @depth: the nesting level, 0 for the top level entries
+ * @parent: the index of the parent entry, or -1 for the top level entries
+ * @chapter: the spine index of @content, or -1 if it's not in the spine
+ *
+ * An entry of the flattened table of contents. Entries are stored in
+ * document order, so the children of an entry follow it.
+ */
+struct _GepubTocEntry {
+    gchar *label;
+    gchar *content;
+    gchar *fragment;
+    guint64 playorder;
+    gint depth;
+    gint parent;
+    gint chapter;
+};
+
+/**
+ * GepubMemoryStats:
+ * @package: the package document
+ * @strings: the manifest, spine and TOC strings
+ * @resources: the manifest and the resource tables
+ * @spine: the spine and its index
+ * @toc: the TOC entries and their indices
+ * @metadata: the metadata table and values
+ * @archive_index: the archive central directory index
+ * @archive_cache: the inflated entries cache
+ * @readahead: the chapters prepared by the read-ahead
+ * @widget: the #GepubWidget own state, 0 for a #GepubDoc
+ * @total: the sum of the above
+ * @n_resources: the number of resources
+ * @n_chapters: the number of spine items
+ * @n_toc_entries: the number of TOC entries, 0 if the TOC wasn't read yet
+ *
+ * Approximate heap bytes held by a doc, per subsystem. Containers are
+ * counted by their elements, not by their allocated capacity.
+ */
+struct _GepubMemoryStats {
+    gsize package;
+    gsize strings;
+    gsize resources;
+    gsize spine;
+    gsize toc;
+    gsize metadata;
+    gsize archive_index;
+    gsize archive_cache;
+    gsize readahead;
+    gsize widget;
+    gsize total;
+    guint n_resources;
+    guint n_chapters;
+    guint n_toc_entries;
+};
+
 typedef struct _GepubResource GepubResource;
 typedef struct _GepubNavPoint GepubNavPoint;
+typedef struct _GepubTocEntry GepubTocEntry;
+typedef struct _GepubMemoryStats GepubMemoryStats;
+
+/**
+ * GepubDocOpenFlags:
+ * @GEPUB_DOC_OPEN_NONE: No flags
+ * @GEPUB_DOC_OPEN_INDEX_CACHE: Keep the parsed package and TOC in an on-disk
+ *   cache, keyed by the file path, size, modification time and inode
+ * @GEPUB_DOC_OPEN_METADATA_ONLY: Only read the package metadata and the
+ *   cover resource. The spine, the other resources and the TOC are empty
+ *
+ * Flags used when opening a #GepubDoc.
+ */
+typedef enum {
+    GEPUB_DOC_OPEN_NONE          = 0,
+    GEPUB_DOC_OPEN_INDEX_CACHE   = 1 << 0,
+    GEPUB_DOC_OPEN_METADATA_ONLY = 1 << 1,
+} GepubDocOpenFlags;
+
+#define GEPUB_TYPE_DOC_OPEN_FLAGS (gepub_doc_open_flags_get_type ())
 
 GType             gepub_doc_get_type                        (void) G_GNUC_CONST;
+GType             gepub_doc_open_flags_get_type             (void) G_GNUC_CONST;
 
 GepubDoc         *gepub_doc_new                             (const gchar *path, GError **error);
+void              gepub_doc_new_async                       (const gchar         *path,
+                                                             GCancellable        *cancellable,
+                                                             GAsyncReadyCallback  callback,
+                                                             gpointer             user_data);
+GepubDoc         *gepub_doc_new_finish                      (GAsyncResult  *result,
+                                                             GError       **error);
+GepubDoc         *gepub_doc_new_with_flags                  (const gchar *path,
+                                                             GepubDocOpenFlags flags,
+                                                             GError **error);
+GepubDoc         *gepub_doc_new_from_file                   (GFile *file, GError **error);
+GepubDoc         *gepub_doc_new_from_bytes                  (GBytes *bytes, GError **error);
+GepubDoc         *gepub_doc_new_from_stream                 (GInputStream *stream, GError **error);
 GBytes           *gepub_doc_get_content                     (GepubDoc *doc);
 gchar            *gepub_doc_get_metadata                    (GepubDoc *doc, const gchar *mdata);
+GHashTable       *gepub_doc_get_all_metadata                (GepubDoc *doc);
 GBytes           *gepub_doc_get_resource                    (GepubDoc *doc, const gchar *path);
 GBytes           *gepub_doc_get_resource_by_id              (GepubDoc *doc, const gchar *id);
+void              gepub_doc_get_resource_async              (GepubDoc            *doc,
+                                                             const gchar         *path,
+                                                             GCancellable        *cancellable,
+                                                             GAsyncReadyCallback  callback,
+                                                             gpointer             user_data);
+GBytes           *gepub_doc_get_resource_finish             (GepubDoc      *doc,
+                                                             GAsyncResult  *result,
+                                                             GError       **error);
+void              gepub_doc_get_resource_by_id_async        (GepubDoc            *doc,
+                                                             const gchar         *id,
+                                                             GCancellable        *cancellable,
+                                                             GAsyncReadyCallback  callback,
+                                                             gpointer             user_data);
+GBytes           *gepub_doc_get_resource_by_id_finish       (GepubDoc      *doc,
+                                                             GAsyncResult  *result,
+                                                             GError       **error);
+GInputStream     *gepub_doc_open_resource_stream            (GepubDoc *doc, const gchar *path, gint64 *size);
 GHashTable       *gepub_doc_get_resources                   (GepubDoc *doc);
 gchar            *gepub_doc_get_resource_mime               (GepubDoc *doc, const gchar *path);
 gchar            *gepub_doc_get_resource_mime_by_id         (GepubDoc *doc, const gchar *id);
+GList            *gepub_doc_get_resources_by_mime           (GepubDoc *doc, const gchar *mime);
 gchar            *gepub_doc_get_current_mime                (GepubDoc *doc);
 GList            *gepub_doc_get_text                        (GepubDoc *doc);
 GList            *gepub_doc_get_text_by_id                  (GepubDoc *doc, const gchar *id);
+void              gepub_doc_get_text_by_id_async            (GepubDoc            *doc,
+                                                             const gchar         *id,
+                                                             GCancellable        *cancellable,
+                                                             GAsyncReadyCallback  callback,
+                                                             gpointer             user_data);
+GList            *gepub_doc_get_text_by_id_finish           (GepubDoc      *doc,
+                                                             GAsyncResult  *result,
+                                                             GError       **error);
 GBytes           *gepub_doc_get_current                     (GepubDoc *doc);
 GBytes           *gepub_doc_get_current_with_epub_uris      (GepubDoc *doc);
+void              gepub_doc_get_current_with_epub_uris_async  (GepubDoc            *doc,
+                                                               GCancellable        *cancellable,
+                                                               GAsyncReadyCallback  callback,
+                                                               gpointer             user_data);
+GBytes           *gepub_doc_get_current_with_epub_uris_finish (GepubDoc      *doc,
+                                                               GAsyncResult  *result,
+                                                               GError       **error);
+GBytes           *gepub_doc_get_chapter_with_epub_uris      (GepubDoc *doc,
+                                                             gint      chapter);
+void              gepub_doc_get_chapter_with_epub_uris_async  (GepubDoc            *doc,
+                                                               gint                 chapter,
+                                                               GCancellable        *cancellable,
+                                                               GAsyncReadyCallback  callback,
+                                                               gpointer             user_data);
+GBytes           *gepub_doc_get_chapter_with_epub_uris_finish (GepubDoc      *doc,
+                                                               GAsyncResult  *result,
+                                                               GError       **error);
 gchar            *gepub_doc_get_cover                       (GepubDoc *doc);
 gchar            *gepub_doc_get_resource_path               (GepubDoc *doc, const gchar *id);
 gchar            *gepub_doc_get_current_path                (GepubDoc *doc);
 const gchar      *gepub_doc_get_current_id                  (GepubDoc *doc);
+const gchar      *gepub_doc_get_chapter_id                  (GepubDoc *doc,
+                                                             gint      chapter);
 
 gboolean          gepub_doc_go_next                         (GepubDoc *doc);
 gboolean          gepub_doc_go_prev                         (GepubDoc *doc);
@@ -77,11 +217,28 @@ void              gepub_doc_set_chapter                     (GepubDoc *doc,
                                                              gint      index);
 
 GList            *gepub_doc_get_toc                         (GepubDoc *doc);
+const GepubTocEntry *gepub_doc_get_toc_entries              (GepubDoc *doc,
+                                                             guint    *n_entries);
+gint              gepub_doc_find_toc_entry                  (GepubDoc    *doc,
+                                                             gint         chapter,
+                                                             const gchar *fragment);
 gint              gepub_doc_resource_uri_to_chapter         (GepubDoc *doc,
                                                              const gchar *uri);
 gint              gepub_doc_resource_id_to_chapter          (GepubDoc *doc,
                                                              const gchar *id);
 
+void              gepub_doc_set_cache_size                  (GepubDoc *doc,
+                                                             gsize     max_size);
+void              gepub_doc_get_cache_stats                 (GepubDoc *doc,
+                                                             guint64  *hits,
+                                                             guint64  *misses,
+                                                             gsize    *size);
+void              gepub_doc_set_readahead                   (GepubDoc *doc,
+                                                             guint     ahead,
+                                                             guint     behind);
+void              gepub_doc_get_memory_stats                (GepubDoc         *doc,
+                                                             GepubMemoryStats *stats);
+
 G_END_DECLS
 
 /**
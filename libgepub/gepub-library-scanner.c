@@ -0,0 +1,512 @@
+/* GepubLibraryScanner
+ *
+ * Copyright (C) 2011 Daniel Garcia <danigm@wadobo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <config.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "gepub-library-scanner.h"
+
+#define GEPUB_LIBRARY_SCANNER_MAX_PENDING 64
+
+/* The paths are queued and handed to the pool from the scanner main
+ * context, so the queue needs no locking. A job is pending from the
+ * moment it's pushed to the pool until its result is emitted, which
+ * bounds the number of docs alive at any time.
+ */
+struct _GepubLibraryScanner {
+    GObject parent;
+
+    guint max_threads;
+    guint max_pending;
+    GepubDocOpenFlags flags;
+
+    GThreadPool *pool;
+    GMainContext *context;
+    GTask *task;                // the running scan
+    GQueue queue;               // paths waiting for a worker
+    guint pending;
+};
+
+struct _GepubLibraryScannerClass {
+    GObjectClass parent_class;
+};
+
+typedef struct {
+    GepubLibraryScanner *scanner;
+    GCancellable *cancellable;
+    GepubDocOpenFlags flags;
+    gchar *path;
+
+    // results
+    gboolean is_dir;
+    GPtrArray *children;        // paths found in a directory
+    GepubDoc *doc;
+    GError *error;
+} GepubScanJob;
+
+enum {
+    PROP_0,
+    PROP_MAX_THREADS,
+    PROP_MAX_PENDING,
+    PROP_FLAGS,
+    NUM_PROPS
+};
+
+enum {
+    BOOK_SCANNED,
+    NUM_SIGNALS
+};
+
+static GParamSpec *properties[NUM_PROPS] = { NULL, };
+static guint signals[NUM_SIGNALS] = { 0, };
+
+G_DEFINE_TYPE (GepubLibraryScanner, gepub_library_scanner, G_TYPE_OBJECT)
+
+static void
+gepub_scan_job_free (GepubScanJob *job)
+{
+    g_object_unref (job->scanner);
+    g_clear_object (&job->cancellable);
+    g_free (job->path);
+    g_clear_pointer (&job->children, g_ptr_array_unref);
+    g_clear_object (&job->doc);
+    g_clear_error (&job->error);
+    g_free (job);
+}
+
+static void
+gepub_library_scanner_finalize (GObject *object)
+{
+    GepubLibraryScanner *scanner = GEPUB_LIBRARY_SCANNER (object);
+
+    // every job holds a reference, so the pool is idle here
+    g_thread_pool_free (scanner->pool, TRUE, FALSE);
+    g_queue_clear_full (&scanner->queue, g_free);
+    g_clear_pointer (&scanner->context, g_main_context_unref);
+
+    G_OBJECT_CLASS (gepub_library_scanner_parent_class)->finalize (object);
+}
+
+static void
+gepub_library_scanner_set_property (GObject      *object,
+                                    guint         prop_id,
+                                    const GValue *value,
+                                    GParamSpec   *pspec)
+{
+    GepubLibraryScanner *scanner = GEPUB_LIBRARY_SCANNER (object);
+
+    switch (prop_id) {
+    case PROP_MAX_THREADS:
+        scanner->max_threads = g_value_get_uint (value);
+        break;
+    case PROP_MAX_PENDING:
+        gepub_library_scanner_set_max_pending (scanner, g_value_get_uint (value));
+        break;
+    case PROP_FLAGS:
+        gepub_library_scanner_set_flags (scanner, g_value_get_flags (value));
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+        break;
+    }
+}
+
+static void
+gepub_library_scanner_get_property (GObject    *object,
+                                    guint       prop_id,
+                                    GValue     *value,
+                                    GParamSpec *pspec)
+{
+    GepubLibraryScanner *scanner = GEPUB_LIBRARY_SCANNER (object);
+
+    switch (prop_id) {
+    case PROP_MAX_THREADS:
+        g_value_set_uint (value, scanner->max_threads);
+        break;
+    case PROP_MAX_PENDING:
+        g_value_set_uint (value, scanner->max_pending);
+        break;
+    case PROP_FLAGS:
+        g_value_set_flags (value, scanner->flags);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+        break;
+    }
+}
+
+static void
+gepub_library_scanner_scan_directory (GepubScanJob *job)
+{
+    GDir *dir;
+    const gchar *name;
+
+    dir = g_dir_open (job->path, 0, &job->error);
+    if (!dir)
+        return;
+
+    job->children = g_ptr_array_new_with_free_func (g_free);
+    while ((name = g_dir_read_name (dir))) {
+        gchar *child;
+        GStatBuf st;
+
+        if (name[0] == '.')
+            continue;
+
+        child = g_build_filename (job->path, name, NULL);
+        // symlinked directories aren't followed, they could make loops
+        if (g_lstat (child, &st) == 0 && S_ISDIR (st.st_mode)) {
+            g_ptr_array_add (job->children, child);
+        } else {
+            g_autofree gchar *key = g_ascii_strdown (name, -1);
+
+            if (g_str_has_suffix (key, ".epub"))
+                g_ptr_array_add (job->children, child);
+            else
+                g_free (child);
+        }
+    }
+
+    g_dir_close (dir);
+}
+
+static void gepub_library_scanner_dispatch (GepubLibraryScanner *scanner);
+
+static gboolean
+gepub_library_scanner_job_done (gpointer user_data)
+{
+    GepubScanJob *job = user_data;
+    GepubLibraryScanner *scanner = job->scanner;
+    guint i;
+
+    scanner->pending--;
+
+    if (!g_cancellable_is_cancelled (job->cancellable)) {
+        if (job->is_dir && job->children) {
+            for (i = 0; i < job->children->len; i++)
+                g_queue_push_tail (&scanner->queue, g_strdup (g_ptr_array_index (job->children, i)));
+        } else {
+            g_signal_emit (scanner, signals[BOOK_SCANNED], 0,
+                           job->path, job->doc, job->error);
+        }
+    }
+
+    gepub_library_scanner_dispatch (scanner);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+gepub_library_scanner_worker (gpointer data,
+                              gpointer user_data)
+{
+    GepubScanJob *job = data;
+    GSource *source;
+
+    if (g_cancellable_set_error_if_cancelled (job->cancellable, &job->error)) {
+        // nothing to do, the result is dropped
+    } else if (g_file_test (job->path, G_FILE_TEST_IS_DIR)) {
+        job->is_dir = TRUE;
+        gepub_library_scanner_scan_directory (job);
+    } else {
+        job->doc = g_initable_new (GEPUB_TYPE_DOC,
+                                   job->cancellable, &job->error,
+                                   "path", job->path,
+                                   "flags", job->flags,
+                                   NULL);
+    }
+
+    // results are emitted in completion order, from the scanner context.
+    // Not g_main_context_invoke(), it would run the callback right here
+    // if no thread owns the context yet
+    source = g_idle_source_new ();
+    g_source_set_priority (source, G_PRIORITY_DEFAULT);
+    g_source_set_callback (source, gepub_library_scanner_job_done, job,
+                           (GDestroyNotify) gepub_scan_job_free);
+    g_source_attach (source, job->scanner->context);
+    g_source_unref (source);
+}
+
+static void
+gepub_library_scanner_dispatch (GepubLibraryScanner *scanner)
+{
+    GCancellable *cancellable;
+    GTask *task;
+
+    if (!scanner->task)
+        return;
+
+    cancellable = g_task_get_cancellable (scanner->task);
+    if (g_cancellable_is_cancelled (cancellable))
+        g_queue_clear_full (&scanner->queue, g_free);
+
+    while (scanner->pending < scanner->max_pending &&
+           !g_queue_is_empty (&scanner->queue)) {
+        GepubScanJob *job = g_new0 (GepubScanJob, 1);
+
+        job->scanner = g_object_ref (scanner);
+        job->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
+        job->flags = scanner->flags;
+        job->path = g_queue_pop_head (&scanner->queue);
+
+        scanner->pending++;
+        g_thread_pool_push (scanner->pool, job, NULL);
+    }
+
+    if (scanner->pending || !g_queue_is_empty (&scanner->queue))
+        return;
+
+    task = g_steal_pointer (&scanner->task);
+    if (!g_task_return_error_if_cancelled (task))
+        g_task_return_boolean (task, TRUE);
+    g_object_unref (task);
+}
+
+static void
+gepub_library_scanner_init (GepubLibraryScanner *scanner)
+{
+    scanner->max_pending = GEPUB_LIBRARY_SCANNER_MAX_PENDING;
+    scanner->flags = GEPUB_DOC_OPEN_NONE;
+    g_queue_init (&scanner->queue);
+}
+
+static void
+gepub_library_scanner_constructed (GObject *object)
+{
+    GepubLibraryScanner *scanner = GEPUB_LIBRARY_SCANNER (object);
+
+    G_OBJECT_CLASS (gepub_library_scanner_parent_class)->constructed (object);
+
+    if (scanner->max_threads == 0)
+        scanner->max_threads = g_get_num_processors ();
+
+    scanner->pool = g_thread_pool_new (gepub_library_scanner_worker, scanner,
+                                       scanner->max_threads, FALSE, NULL);
+}
+
+static void
+gepub_library_scanner_class_init (GepubLibraryScannerClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    object_class->constructed = gepub_library_scanner_constructed;
+    object_class->finalize = gepub_library_scanner_finalize;
+    object_class->set_property = gepub_library_scanner_set_property;
+    object_class->get_property = gepub_library_scanner_get_property;
+
+    properties[PROP_MAX_THREADS] =
+        g_param_spec_uint ("max-threads",
+                           "Max threads",
+                           "Number of books opened in parallel, 0 for one per processor",
+                           0, G_MAXUINT, 0,
+                           G_PARAM_READWRITE |
+                           G_PARAM_CONSTRUCT_ONLY |
+                           G_PARAM_STATIC_STRINGS);
+    properties[PROP_MAX_PENDING] =
+        g_param_spec_uint ("max-pending",
+                           "Max pending",
+                           "Number of books being opened or waiting to be emitted",
+                           1, G_MAXUINT, GEPUB_LIBRARY_SCANNER_MAX_PENDING,
+                           G_PARAM_READWRITE |
+                           G_PARAM_STATIC_STRINGS);
+    properties[PROP_FLAGS] =
+        g_param_spec_flags ("flags",
+                            "Flags",
+                            "Flags used to open the books",
+                            GEPUB_TYPE_DOC_OPEN_FLAGS,
+                            GEPUB_DOC_OPEN_NONE,
+                            G_PARAM_READWRITE |
+                            G_PARAM_STATIC_STRINGS);
+
+    g_object_class_install_properties (object_class, NUM_PROPS, properties);
+
+    /**
+     * GepubLibraryScanner::book-scanned:
+     * @scanner: the #GepubLibraryScanner
+     * @path: the book path
+     * @doc: (nullable): the open book, or %NULL if it can't be opened
+     * @error: (nullable): the reason @doc is %NULL
+     *
+     * Emitted for every book found, in the order they're done, from
+     * the thread-default main context of the scan_async() caller. Keep
+     * a reference to @doc to use it after the handler returns.
+     */
+    signals[BOOK_SCANNED] =
+        g_signal_new ("book-scanned",
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      0, NULL, NULL, NULL,
+                      G_TYPE_NONE, 3,
+                      G_TYPE_STRING,
+                      GEPUB_TYPE_DOC,
+                      G_TYPE_ERROR);
+}
+
+/**
+ * gepub_library_scanner_new:
+ * @max_threads: the number of books opened in parallel, 0 for one per
+ *   processor
+ *
+ * Returns: (transfer full): the new #GepubLibraryScanner
+ */
+GepubLibraryScanner *
+gepub_library_scanner_new (guint max_threads)
+{
+    return g_object_new (GEPUB_TYPE_LIBRARY_SCANNER,
+                         "max-threads", max_threads,
+                         NULL);
+}
+
+/**
+ * gepub_library_scanner_get_max_pending:
+ * @scanner: a #GepubLibraryScanner
+ *
+ * Returns: the number of books that can be open at the same time
+ */
+guint
+gepub_library_scanner_get_max_pending (GepubLibraryScanner *scanner)
+{
+    g_return_val_if_fail (GEPUB_IS_LIBRARY_SCANNER (scanner), 0);
+
+    return scanner->max_pending;
+}
+
+/**
+ * gepub_library_scanner_set_max_pending:
+ * @scanner: a #GepubLibraryScanner
+ * @max_pending: the number of books that can be open at the same time
+ *
+ * Limits the books being opened plus the ones waiting for the
+ * #GepubLibraryScanner::book-scanned emission. No more books are opened
+ * while the main context is busy, so a slow consumer doesn't pile up
+ * results.
+ */
+void
+gepub_library_scanner_set_max_pending (GepubLibraryScanner *scanner,
+                                       guint                max_pending)
+{
+    g_return_if_fail (GEPUB_IS_LIBRARY_SCANNER (scanner));
+    g_return_if_fail (max_pending > 0);
+
+    if (scanner->max_pending == max_pending)
+        return;
+
+    scanner->max_pending = max_pending;
+    gepub_library_scanner_dispatch (scanner);
+
+    g_object_notify_by_pspec (G_OBJECT (scanner), properties[PROP_MAX_PENDING]);
+}
+
+/**
+ * gepub_library_scanner_get_flags:
+ * @scanner: a #GepubLibraryScanner
+ *
+ * Returns: the flags used to open the books
+ */
+GepubDocOpenFlags
+gepub_library_scanner_get_flags (GepubLibraryScanner *scanner)
+{
+    g_return_val_if_fail (GEPUB_IS_LIBRARY_SCANNER (scanner), GEPUB_DOC_OPEN_NONE);
+
+    return scanner->flags;
+}
+
+/**
+ * gepub_library_scanner_set_flags:
+ * @scanner: a #GepubLibraryScanner
+ * @flags: the #GepubDocOpenFlags
+ *
+ * Sets the flags used to open the books. With
+ * %GEPUB_DOC_OPEN_METADATA_ONLY the metadata and the cover path are
+ * available, but the chapter count is 0.
+ */
+void
+gepub_library_scanner_set_flags (GepubLibraryScanner *scanner,
+                                 GepubDocOpenFlags    flags)
+{
+    g_return_if_fail (GEPUB_IS_LIBRARY_SCANNER (scanner));
+
+    if (scanner->flags == flags)
+        return;
+
+    scanner->flags = flags;
+
+    g_object_notify_by_pspec (G_OBJECT (scanner), properties[PROP_FLAGS]);
+}
+
+/**
+ * gepub_library_scanner_scan_async:
+ * @scanner: a #GepubLibraryScanner
+ * @paths: (array zero-terminated=1): the books and directories to scan
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: a #GAsyncReadyCallback to call when every book is done
+ * @user_data: the data to pass to @callback
+ *
+ * Opens every book in @paths in the scanner thread pool. Directories
+ * are walked recursively looking for .epub files. Each book is reported
+ * with the #GepubLibraryScanner::book-scanned signal as soon as it's
+ * done. Only one scan can run at a time.
+ */
+void
+gepub_library_scanner_scan_async (GepubLibraryScanner *scanner,
+                                  const gchar * const *paths,
+                                  GCancellable        *cancellable,
+                                  GAsyncReadyCallback  callback,
+                                  gpointer             user_data)
+{
+    guint i;
+
+    g_return_if_fail (GEPUB_IS_LIBRARY_SCANNER (scanner));
+    g_return_if_fail (paths != NULL);
+    g_return_if_fail (scanner->task == NULL);
+
+    scanner->task = g_task_new (scanner, cancellable, callback, user_data);
+    g_task_set_source_tag (scanner->task, gepub_library_scanner_scan_async);
+
+    g_clear_pointer (&scanner->context, g_main_context_unref);
+    scanner->context = g_main_context_ref_thread_default ();
+
+    for (i = 0; paths[i]; i++)
+        g_queue_push_tail (&scanner->queue, g_strdup (paths[i]));
+
+    gepub_library_scanner_dispatch (scanner);
+}
+
+/**
+ * gepub_library_scanner_scan_finish:
+ * @scanner: a #GepubLibraryScanner
+ * @result: the #GAsyncResult passed to the callback
+ * @error: (nullable): Error
+ *
+ * Finishes an operation started with gepub_library_scanner_scan_async().
+ * Books that can't be opened don't make the scan fail, they're reported
+ * with the #GepubLibraryScanner::book-scanned signal.
+ *
+ * Returns: %TRUE if every book was scanned, %FALSE if it was cancelled
+ */
+gboolean
+gepub_library_scanner_scan_finish (GepubLibraryScanner  *scanner,
+                                   GAsyncResult         *result,
+                                   GError              **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, scanner), FALSE);
+
+    return g_task_propagate_boolean (G_TASK (result), error);
+}
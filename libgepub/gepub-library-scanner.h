@@ -0,0 +1,63 @@
+/* GepubLibraryScanner
+ *
+ * Copyright (C) 2011  Daniel Garcia <danigm@wadobo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GEPUB_LIBRARY_SCANNER_H__
+#define __GEPUB_LIBRARY_SCANNER_H__
+
+#include <glib-object.h>
+#include <gio/gio.h>
+#include <glib.h>
+
+#include "gepub-doc.h"
+
+G_BEGIN_DECLS
+
+#define GEPUB_TYPE_LIBRARY_SCANNER           (gepub_library_scanner_get_type ())
+#define GEPUB_LIBRARY_SCANNER(obj)           (G_TYPE_CHECK_INSTANCE_CAST (obj, GEPUB_TYPE_LIBRARY_SCANNER, GepubLibraryScanner))
+#define GEPUB_LIBRARY_SCANNER_CLASS(cls)     (G_TYPE_CHECK_CLASS_CAST (cls, GEPUB_TYPE_LIBRARY_SCANNER, GepubLibraryScannerClass))
+#define GEPUB_IS_LIBRARY_SCANNER(obj)        (G_TYPE_CHECK_INSTANCE_TYPE (obj, GEPUB_TYPE_LIBRARY_SCANNER))
+#define GEPUB_IS_LIBRARY_SCANNER_CLASS(obj)  (G_TYPE_CHECK_CLASS_TYPE (obj, GEPUB_TYPE_LIBRARY_SCANNER))
+#define GEPUB_LIBRARY_SCANNER_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS ((obj), GEPUB_TYPE_LIBRARY_SCANNER, GepubLibraryScannerClass))
+
+typedef struct _GepubLibraryScanner      GepubLibraryScanner;
+typedef struct _GepubLibraryScannerClass GepubLibraryScannerClass;
+
+GType                gepub_library_scanner_get_type          (void) G_GNUC_CONST;
+
+GepubLibraryScanner *gepub_library_scanner_new               (guint max_threads);
+
+guint                gepub_library_scanner_get_max_pending   (GepubLibraryScanner *scanner);
+void                 gepub_library_scanner_set_max_pending   (GepubLibraryScanner *scanner,
+                                                              guint                max_pending);
+GepubDocOpenFlags    gepub_library_scanner_get_flags         (GepubLibraryScanner *scanner);
+void                 gepub_library_scanner_set_flags         (GepubLibraryScanner *scanner,
+                                                              GepubDocOpenFlags    flags);
+
+void                 gepub_library_scanner_scan_async        (GepubLibraryScanner *scanner,
+                                                              const gchar * const *paths,
+                                                              GCancellable        *cancellable,
+                                                              GAsyncReadyCallback  callback,
+                                                              gpointer             user_data);
+gboolean             gepub_library_scanner_scan_finish       (GepubLibraryScanner *scanner,
+                                                              GAsyncResult        *result,
+                                                              GError             **error);
+
+G_END_DECLS
+
+#endif /* __GEPUB_LIBRARY_SCANNER_H__ */
@@ -0,0 +1,39 @@
+/* GepubTrace
+ *
+ * Copyright (C) 2011  Daniel Garcia <danigm@wadobo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#ifndef __GEPUB_TRACE_PRIVATE_H__
+#define __GEPUB_TRACE_PRIVATE_H__
+
+#include "gepub-trace.h"
+
+/* Not part of the API, the leading underscore keeps them out of the
+ * exported gepub_* symbols and the introspection data.
+ */
+
+// returns the begin time to pass to _gepub_trace_end()
+#define _gepub_trace_begin() g_get_monotonic_time ()
+
+void _gepub_trace_end (GepubTraceStage  stage,
+                       gint64           begin_time,
+                       const gchar     *path,
+                       gsize            in_size,
+                       gsize            out_size);
+
+#endif
@@ -0,0 +1,187 @@
+/* GepubTrace
+ *
+ * Copyright (C) 2011  Daniel Garcia <danigm@wadobo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include <config.h>
+#include <string.h>
+
+#ifdef HAVE_SYSPROF
+#include <sysprof-capture.h>
+#endif
+
+#include "gepub-trace.h"
+#include "gepub-trace-private.h"
+
+/* The counters are always kept, they're a few additions per stage
+ * under a lock of their own, so the readers of different stages don't
+ * wait for each other. The trace function and the sysprof marks are
+ * only paid for when they're used.
+ */
+static GepubTraceCounters stage_counters[GEPUB_TRACE_N_STAGES];
+static GMutex stage_locks[GEPUB_TRACE_N_STAGES];
+
+// func_set is checked before taking func_lock on every stage end
+static GRWLock func_lock;
+static gint func_set;
+static GepubTraceFunc trace_func;
+static gpointer trace_data;
+static GDestroyNotify trace_destroy;
+
+static const GEnumValue stage_values[] = {
+    { GEPUB_TRACE_ARCHIVE_OPEN, "GEPUB_TRACE_ARCHIVE_OPEN", "archive-open" },
+    { GEPUB_TRACE_ENTRY_READ, "GEPUB_TRACE_ENTRY_READ", "entry-read" },
+    { GEPUB_TRACE_PACKAGE_PARSE, "GEPUB_TRACE_PACKAGE_PARSE", "package-parse" },
+    { GEPUB_TRACE_TOC_PARSE, "GEPUB_TRACE_TOC_PARSE", "toc-parse" },
+    { GEPUB_TRACE_URI_REWRITE, "GEPUB_TRACE_URI_REWRITE", "uri-rewrite" },
+    { GEPUB_TRACE_TEXT_EXTRACT, "GEPUB_TRACE_TEXT_EXTRACT", "text-extract" },
+    { GEPUB_TRACE_RESOURCE_SERVE, "GEPUB_TRACE_RESOURCE_SERVE", "resource-serve" },
+    { 0, NULL, NULL }
+};
+
+GType
+gepub_trace_stage_get_type (void)
+{
+    static gsize type_id = 0;
+
+    if (g_once_init_enter (&type_id)) {
+        GType type = g_enum_register_static (g_intern_static_string ("GepubTraceStage"), stage_values);
+        g_once_init_leave (&type_id, type);
+    }
+
+    return type_id;
+}
+
+/**
+ * gepub_trace_stage_get_name:
+ * @stage: a #GepubTraceStage
+ *
+ * Returns: (transfer none): the short name of @stage, like "entry-read"
+ */
+const gchar *
+gepub_trace_stage_get_name (GepubTraceStage stage)
+{
+    g_return_val_if_fail (stage < GEPUB_TRACE_N_STAGES, NULL);
+
+    return stage_values[stage].value_nick;
+}
+
+/**
+ * gepub_trace_set_func:
+ * @func: (nullable) (scope notified): the function to call when a stage
+ *   ends, or %NULL to stop tracing
+ * @user_data: the data to pass to @func
+ * @destroy: (nullable): called on @user_data when it's not used anymore
+ *
+ * Sets the process-wide trace function. It's called from the thread
+ * that ran the stage, so it must be thread safe, and it shouldn't call
+ * into libgepub.
+ */
+void
+gepub_trace_set_func (GepubTraceFunc func,
+                      gpointer       user_data,
+                      GDestroyNotify destroy)
+{
+    gpointer old_data;
+    GDestroyNotify old_destroy;
+
+    g_rw_lock_writer_lock (&func_lock);
+    old_data = trace_data;
+    old_destroy = trace_destroy;
+    trace_func = func;
+    trace_data = user_data;
+    trace_destroy = destroy;
+    g_atomic_int_set (&func_set, func != NULL);
+    g_rw_lock_writer_unlock (&func_lock);
+
+    if (old_destroy)
+        old_destroy (old_data);
+}
+
+/**
+ * gepub_trace_get_counters:
+ * @stage: a #GepubTraceStage
+ * @counters: (out caller-allocates): return location for the counters
+ *
+ * Gets the totals of @stage, for every doc in the process.
+ */
+void
+gepub_trace_get_counters (GepubTraceStage     stage,
+                          GepubTraceCounters *counters)
+{
+    g_return_if_fail (stage < GEPUB_TRACE_N_STAGES);
+    g_return_if_fail (counters != NULL);
+
+    g_mutex_lock (&stage_locks[stage]);
+    *counters = stage_counters[stage];
+    g_mutex_unlock (&stage_locks[stage]);
+}
+
+/**
+ * gepub_trace_reset_counters:
+ *
+ * Sets every stage counters back to 0.
+ */
+void
+gepub_trace_reset_counters (void)
+{
+    guint i;
+
+    for (i = 0; i < GEPUB_TRACE_N_STAGES; i++) {
+        g_mutex_lock (&stage_locks[i]);
+        memset (&stage_counters[i], 0, sizeof (GepubTraceCounters));
+        g_mutex_unlock (&stage_locks[i]);
+    }
+}
+
+void
+_gepub_trace_end (GepubTraceStage  stage,
+                  gint64           begin_time,
+                  const gchar     *path,
+                  gsize            in_size,
+                  gsize            out_size)
+{
+    gint64 duration = g_get_monotonic_time () - begin_time;
+    GepubTraceCounters *c = &stage_counters[stage];
+
+    // 64 bits atomics aren't there on every 32 bits target, lock
+    g_mutex_lock (&stage_locks[stage]);
+    c->calls++;
+    c->bytes_in += in_size;
+    c->bytes_out += out_size;
+    c->time += duration;
+    g_mutex_unlock (&stage_locks[stage]);
+
+#ifdef HAVE_SYSPROF
+    // both clocks are CLOCK_MONOTONIC, sysprof counts in nanoseconds
+    if (sysprof_collector_is_active ()) {
+        sysprof_collector_mark_printf (begin_time * 1000, duration * 1000,
+                                       "gepub", stage_values[stage].value_nick,
+                                       "%s: %" G_GSIZE_FORMAT " -> %" G_GSIZE_FORMAT " bytes",
+                                       path ? path : "", in_size, out_size);
+    }
+#endif
+
+    if (!g_atomic_int_get (&func_set))
+        return;
+
+    g_rw_lock_reader_lock (&func_lock);
+    if (trace_func)
+        trace_func (stage, path, in_size, out_size, begin_time, duration, trace_data);
+    g_rw_lock_reader_unlock (&func_lock);
+}
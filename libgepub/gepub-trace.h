@@ -0,0 +1,106 @@
+/* GepubTrace
+ *
+ * Copyright (C) 2011  Daniel Garcia <danigm@wadobo.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#ifndef __GEPUB_TRACE_H__
+#define __GEPUB_TRACE_H__
+
+#include <glib-object.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * GepubTraceStage:
+ * @GEPUB_TRACE_ARCHIVE_OPEN: Reading the archive central directory
+ * @GEPUB_TRACE_ENTRY_READ: Reading and inflating an archive entry
+ * @GEPUB_TRACE_PACKAGE_PARSE: Parsing the OPF package document
+ * @GEPUB_TRACE_TOC_PARSE: Parsing the nav document or the NCX
+ * @GEPUB_TRACE_URI_REWRITE: Rewriting a chapter resource uris
+ * @GEPUB_TRACE_TEXT_EXTRACT: Extracting the text of a chapter
+ * @GEPUB_TRACE_RESOURCE_SERVE: Serving a resource to the #GepubWidget
+ * @GEPUB_TRACE_N_STAGES: The number of stages
+ *
+ * The steps of loading and showing a book that are traced.
+ */
+typedef enum {
+    GEPUB_TRACE_ARCHIVE_OPEN,
+    GEPUB_TRACE_ENTRY_READ,
+    GEPUB_TRACE_PACKAGE_PARSE,
+    GEPUB_TRACE_TOC_PARSE,
+    GEPUB_TRACE_URI_REWRITE,
+    GEPUB_TRACE_TEXT_EXTRACT,
+    GEPUB_TRACE_RESOURCE_SERVE,
+    GEPUB_TRACE_N_STAGES
+} GepubTraceStage;
+
+#define GEPUB_TYPE_TRACE_STAGE (gepub_trace_stage_get_type ())
+
+/**
+ * GepubTraceCounters:
+ * @calls: the number of times the stage ran
+ * @bytes_in: the bytes read by the stage
+ * @bytes_out: the bytes produced by the stage
+ * @time: the time spent in the stage, in microseconds
+ *
+ * The totals of a stage since the process started or the last
+ * gepub_trace_reset_counters().
+ */
+struct _GepubTraceCounters {
+    guint64 calls;
+    guint64 bytes_in;
+    guint64 bytes_out;
+    gint64 time;
+};
+
+typedef struct _GepubTraceCounters GepubTraceCounters;
+
+/**
+ * GepubTraceFunc:
+ * @stage: the stage that ran
+ * @path: (nullable): the entry, chapter or archive it worked on
+ * @in_size: the bytes read
+ * @out_size: the bytes produced
+ * @begin_time: when it started, in g_get_monotonic_time() microseconds
+ * @duration: how long it took, in microseconds
+ * @user_data: the data passed to gepub_trace_set_func()
+ *
+ * Called when a stage ends, from the thread that ran it.
+ */
+typedef void (*GepubTraceFunc) (GepubTraceStage  stage,
+                                const gchar     *path,
+                                gsize            in_size,
+                                gsize            out_size,
+                                gint64           begin_time,
+                                gint64           duration,
+                                gpointer         user_data);
+
+GType             gepub_trace_stage_get_type      (void) G_GNUC_CONST;
+const gchar      *gepub_trace_stage_get_name      (GepubTraceStage stage);
+
+void              gepub_trace_set_func            (GepubTraceFunc  func,
+                                                   gpointer        user_data,
+                                                   GDestroyNotify  destroy);
+void              gepub_trace_get_counters        (GepubTraceStage     stage,
+                                                   GepubTraceCounters *counters);
+void              gepub_trace_reset_counters      (void);
+
+G_END_DECLS
+
+#endif /* __GEPUB_TRACE_H__ */
@@ -25,6 +25,7 @@
 
 #include "gepub-utils.h"
 #include "gepub-text-chunk.h"
+#include "gepub-trace-private.h"
 
 
 /* Replaces the attr value with epub:/// prefix for the tagname. This
@@ -263,9 +264,11 @@ gepub_utils_replace_resources (GBytes *content, const gchar *path)
     xmlNode *root_element = NULL;
     guchar *buffer;
     const gchar *data;
-    gsize bufsize;
+    gsize bufsize, in_size;
+    gint64 begin = _gepub_trace_begin ();
 
     data = g_bytes_get_data (content, &bufsize);
+    in_size = bufsize;
     doc = xmlReadMemory (data, bufsize, "", NULL, XML_PARSE_NOWARNING | XML_PARSE_NOERROR);
     root_element = xmlDocGetRootElement (doc);
 
@@ -281,10 +284,73 @@ gepub_utils_replace_resources (GBytes *content, const gchar *path)
     xmlDocDumpFormatMemory (doc, (xmlChar**)&buffer, (int*)&bufsize, 1);
     xmlFreeDoc (doc);
 
+    _gepub_trace_end (GEPUB_TRACE_URI_REWRITE, begin, path, in_size, bufsize);
+
     return g_bytes_new_take (buffer, bufsize);
 }
 
 
+/* Returns the path of the package document in @container, the
+ * META-INF/container.xml content, or %NULL if it can't be found.
+ */
+gchar *
+_gepub_utils_get_root_file (GBytes *container)
+{
+    xmlTextReader *reader;
+    gchar *root_file = NULL;
+
+    reader = _gepub_utils_reader_new (container);
+    if (!reader)
+        return NULL;
+
+    while (xmlTextReaderRead (reader) == 1) {
+        if (xmlTextReaderNodeType (reader) == XML_READER_TYPE_ELEMENT &&
+            !g_strcmp0 ((const gchar *) xmlTextReaderConstLocalName (reader), "rootfile")) {
+            root_file = _gepub_utils_reader_get_attr (reader, "full-path");
+            break;
+        }
+    }
+
+    xmlFreeTextReader (reader);
+
+    return root_file;
+}
+
+/* Creates a streaming reader on the XML document @bytes that recovers
+ * from errors, like xmlRecoverMemory() does. @bytes must outlive the
+ * reader, free it with xmlFreeTextReader().
+ */
+xmlTextReader *
+_gepub_utils_reader_new (GBytes *bytes)
+{
+    const gchar *buffer;
+    gsize bufsize;
+
+    buffer = g_bytes_get_data (bytes, &bufsize);
+
+    return xmlReaderForMemory (buffer, bufsize, NULL, NULL,
+                               XML_PARSE_RECOVER | XML_PARSE_NONET |
+                               XML_PARSE_NOERROR | XML_PARSE_NOWARNING);
+}
+
+/* Returns the @name attribute of the element @reader is on, or %NULL
+ * if it's not set.
+ */
+gchar *
+_gepub_utils_reader_get_attr (xmlTextReader *reader, const gchar *name)
+{
+    xmlChar *p = NULL;
+    gchar *ret = NULL;
+
+    p = xmlTextReaderGetAttribute (reader, (const xmlChar *) name);
+    if (p) {
+        ret = g_strdup ((char *) p);
+        xmlFree (p);
+    }
+
+    return ret;
+}
+
 /**
  * gepub_utils_get_prop:
  * @node: an #xmlNode
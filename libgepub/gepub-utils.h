@@ -21,6 +21,7 @@
 
 #include <glib.h>
 #include <libxml/tree.h>
+#include <libxml/xmlreader.h>
 
 xmlNode * gepub_utils_get_element_by_tag  (xmlNode *node, const gchar *name);
 xmlNode * gepub_utils_get_element_by_attr (xmlNode *node, const gchar *attr, const gchar *value);
@@ -28,4 +29,9 @@ GList *   gepub_utils_get_text_elements   (xmlNode *node);
 GBytes *  gepub_utils_replace_resources   (GBytes *content, const gchar *path);
 gchar *   gepub_utils_get_prop            (xmlNode *node, const gchar *prop);
 
+// internal, the underscore keeps them out of gepub.map and the GIR
+gchar *         _gepub_utils_get_root_file   (GBytes *container);
+xmlTextReader * _gepub_utils_reader_new      (GBytes *bytes);
+gchar *         _gepub_utils_reader_get_attr (xmlTextReader *reader, const gchar *name);
+
 #endif
@@ -21,8 +21,10 @@
 #include <gtk/gtk.h>
 #include <JavaScriptCore/JSValueRef.h>
 #include <locale.h>
+#include <string.h>
 
 #include "gepub-widget.h"
+#include "gepub-trace-private.h"
 
 struct _GepubWidget {
     WebKitWebView parent;
@@ -37,6 +39,9 @@ struct _GepubWidget {
     gint font_size; // font size in pt
     gchar *font_family;
     gfloat line_height;
+
+    GCancellable *load_cancellable; // pending chapter load
+    guint doc_serial; // bumped when the doc changes, to drop stale async loads
 };
 
 struct _GepubWidgetClass {
@@ -276,20 +281,27 @@ resource_callback (WebKitURISchemeRequest *request, gpointer user_data)
     gchar *path;
     gchar *mime;
     GepubWidget *widget = user_data;
-    GBytes *contents;
+    gint64 size = 0;
+    gint64 begin;
 
     if (!widget->doc)
       return;
 
+    begin = _gepub_trace_begin ();
+
     path = g_strdup (webkit_uri_scheme_request_get_path (request));
-    contents = gepub_doc_get_resource (widget->doc, path);
+    // the resource is inflated while webkit reads it, so big media
+    // files don't need to be loaded in memory first
+    stream = gepub_doc_open_resource_stream (widget->doc, path, &size);
     mime = gepub_doc_get_resource_mime (widget->doc, path);
 
     // if the resource requested doesn't exist, we should serve an
     // empty document instead of nothing at all (otherwise some
     // poorly-structured ebooks will fail to render).
-    if (!contents) {
-        contents = g_byte_array_free_to_bytes(g_byte_array_sized_new(0));
+    if (!stream) {
+        stream = g_memory_input_stream_new ();
+        size = 0;
+        g_free (mime);
         mime = g_strdup("application/octet-stream");
     }
 
@@ -297,11 +309,11 @@ resource_callback (WebKitURISchemeRequest *request, gpointer user_data)
         mime = g_strdup("application/octet-stream");
     }
 
-    stream = g_memory_input_stream_new_from_bytes (contents);
-    webkit_uri_scheme_request_finish (request, stream, g_bytes_get_size (contents), mime);
+    // the entry is inflated later, as webkit reads the stream
+    _gepub_trace_end (GEPUB_TRACE_RESOURCE_SERVE, begin, path, 0, size);
+    webkit_uri_scheme_request_finish (request, stream, size, mime);
 
     g_object_unref (stream);
-    g_bytes_unref (contents);
     g_free (mime);
     g_free (path);
 }
@@ -371,6 +383,11 @@ gepub_widget_finalize (GObject *object)
     g_clear_pointer (&widget->font_family, g_free);
     g_clear_object (&widget->doc);
 
+    if (widget->load_cancellable) {
+        g_cancellable_cancel (widget->load_cancellable);
+        g_clear_object (&widget->load_cancellable);
+    }
+
     G_OBJECT_CLASS (gepub_widget_parent_class)->finalize (object);
 }
 
@@ -508,23 +525,60 @@ gepub_widget_get_doc (GepubWidget *widget)
 }
 
 static void
-reload_current_chapter (GepubWidget *widget)
+current_chapter_loaded_cb (GObject      *source,
+                           GAsyncResult *result,
+                           gpointer      user_data)
 {
+    GepubWidget *widget = user_data;
     GBytes *current;
+    gchar *mime;
+    GError *error = NULL;
+
+    current = gepub_doc_get_current_with_epub_uris_finish (GEPUB_DOC (source), result, &error);
+    if (!current && g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        // the widget may be gone, and a newer load owns load_cancellable
+        g_error_free (error);
+        return;
+    }
+
+    // not cancelled, so this is still the widget's pending load
+    g_clear_object (&widget->load_cancellable);
+
+    if (!current) {
+        g_warning ("Can't load the current chapter: %s", error->message);
+        g_error_free (error);
+        return;
+    }
+
+    mime = gepub_doc_get_current_mime (widget->doc);
+    webkit_web_view_load_bytes (WEBKIT_WEB_VIEW (widget),
+                                current, mime,
+                                "UTF-8", NULL);
+    g_free (mime);
+    g_bytes_unref (current);
+}
 
+static void
+reload_current_chapter (GepubWidget *widget)
+{
     widget->chapter_length = 0;
     widget->chapter_pos = 0;
     widget->length = 0;
 
+    // a quick reader could be several chapters away by now
+    if (widget->load_cancellable) {
+        g_cancellable_cancel (widget->load_cancellable);
+        g_clear_object (&widget->load_cancellable);
+    }
+
     if (widget->doc == NULL)
         return;
 
-    current = gepub_doc_get_current_with_epub_uris (widget->doc);
-    webkit_web_view_load_bytes (WEBKIT_WEB_VIEW (widget),
-                                current,
-                                gepub_doc_get_current_mime (widget->doc),
-                                "UTF-8", NULL);
-    g_bytes_unref (current);
+    widget->load_cancellable = g_cancellable_new ();
+    gepub_doc_get_current_with_epub_uris_async (widget->doc,
+                                                widget->load_cancellable,
+                                                current_chapter_loaded_cb,
+                                                widget);
 }
 
 /**
@@ -532,7 +586,9 @@ reload_current_chapter (GepubWidget *widget)
  * @widget: a #GepubWidget
  * @doc: (nullable): a #GepubDoc
  *
- * Sets @doc as the document displayed by the widget.
+ * Sets @doc as the document displayed by the widget. The doc read-ahead
+ * is left as it is, use gepub_doc_set_readahead() to have the next
+ * chapters ready for page turns.
  */
 void
 gepub_widget_set_doc (GepubWidget *widget,
@@ -543,6 +599,8 @@ gepub_widget_set_doc (GepubWidget *widget,
     if (widget->doc == doc)
         return;
 
+    widget->doc_serial++;
+
     if (widget->doc != NULL) {
         g_signal_handlers_disconnect_by_func (widget->doc,
                                               reload_current_chapter, widget);
@@ -561,6 +619,86 @@ gepub_widget_set_doc (GepubWidget *widget,
     g_object_notify_by_pspec (G_OBJECT (widget), properties[PROP_DOC]);
 }
 
+static void
+doc_loaded_cb (GObject      *source,
+               GAsyncResult *result,
+               gpointer      user_data)
+{
+    GTask *task = user_data;
+    GepubWidget *widget = g_task_get_source_object (task);
+    GepubDoc *doc;
+    GError *error = NULL;
+
+    doc = gepub_doc_new_finish (result, &error);
+    if (!doc) {
+        g_task_return_error (task, error);
+    } else if (g_task_return_error_if_cancelled (task)) {
+        g_object_unref (doc);
+    } else if (GPOINTER_TO_UINT (g_task_get_task_data (task)) != widget->doc_serial) {
+        // another doc was set while this one was loading
+        g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                 "The widget doc was replaced");
+        g_object_unref (doc);
+    } else {
+        gepub_widget_set_doc (widget, doc);
+        g_object_unref (doc);
+        g_task_return_boolean (task, TRUE);
+    }
+
+    g_object_unref (task);
+}
+
+/**
+ * gepub_widget_load_doc_async:
+ * @widget: a #GepubWidget
+ * @path: the epub doc path
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: a #GAsyncReadyCallback to call when the doc is displayed
+ * @user_data: the data to pass to @callback
+ *
+ * Opens the epub doc at @path without blocking, see gepub_doc_new_async(),
+ * and sets it as the document displayed by the widget once it's open.
+ * Setting another doc meanwhile, or starting another load, drops this one.
+ */
+void
+gepub_widget_load_doc_async (GepubWidget         *widget,
+                             const gchar         *path,
+                             GCancellable        *cancellable,
+                             GAsyncReadyCallback  callback,
+                             gpointer             user_data)
+{
+    GTask *task;
+
+    g_return_if_fail (GEPUB_IS_WIDGET (widget));
+    g_return_if_fail (path != NULL);
+
+    task = g_task_new (widget, cancellable, callback, user_data);
+    g_task_set_source_tag (task, gepub_widget_load_doc_async);
+    g_task_set_task_data (task, GUINT_TO_POINTER (++widget->doc_serial), NULL);
+
+    gepub_doc_new_async (path, cancellable, doc_loaded_cb, task);
+}
+
+/**
+ * gepub_widget_load_doc_finish:
+ * @widget: a #GepubWidget
+ * @result: the #GAsyncResult passed to the callback
+ * @error: (nullable): Error
+ *
+ * Finishes an operation started with gepub_widget_load_doc_async().
+ *
+ * Returns: %TRUE if the doc was opened and set in the widget
+ */
+gboolean
+gepub_widget_load_doc_finish (GepubWidget   *widget,
+                              GAsyncResult  *result,
+                              GError       **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, widget), FALSE);
+
+    return g_task_propagate_boolean (G_TASK (result), error);
+}
+
 /**
  * gepub_widget_get_paginate:
  * @widget: a #GepubWidget
@@ -866,3 +1004,30 @@ gepub_widget_set_lineheight (GepubWidget *widget,
     widget->line_height = size;
     reload_length_cb (GTK_WIDGET (widget), NULL, NULL);
 }
+
+/**
+ * gepub_widget_get_memory_stats:
+ * @widget: a #GepubWidget
+ * @stats: (out caller-allocates): return location for the stats
+ *
+ * Gets the memory held by the widget doc, see gepub_doc_get_memory_stats(),
+ * plus the widget own reading state in the widget field. The web view
+ * memory is not counted.
+ */
+void
+gepub_widget_get_memory_stats (GepubWidget      *widget,
+                               GepubMemoryStats *stats)
+{
+    g_return_if_fail (GEPUB_IS_WIDGET (widget));
+    g_return_if_fail (stats != NULL);
+
+    if (widget->doc)
+        gepub_doc_get_memory_stats (widget->doc, stats);
+    else
+        memset (stats, 0, sizeof (GepubMemoryStats));
+
+    stats->widget = sizeof (GepubWidget) - sizeof (WebKitWebView);
+    if (widget->font_family)
+        stats->widget += strlen (widget->font_family) + 1;
+    stats->total += stats->widget;
+}
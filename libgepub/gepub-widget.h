@@ -45,6 +45,14 @@ GtkWidget        *gepub_widget_new                             (void);
 GepubDoc         *gepub_widget_get_doc                         (GepubWidget *widget);
 void              gepub_widget_set_doc                         (GepubWidget *widget,
                                                                 GepubDoc    *doc);
+void              gepub_widget_load_doc_async                  (GepubWidget         *widget,
+                                                                const gchar         *path,
+                                                                GCancellable        *cancellable,
+                                                                GAsyncReadyCallback  callback,
+                                                                gpointer             user_data);
+gboolean          gepub_widget_load_doc_finish                 (GepubWidget   *widget,
+                                                                GAsyncResult  *result,
+                                                                GError       **error);
 
 gboolean          gepub_widget_get_paginate                    (GepubWidget *widget);
 void              gepub_widget_set_paginate                    (GepubWidget *widget, gboolean p);
@@ -79,6 +87,9 @@ gfloat            gepub_widget_get_lineheight                  (GepubWidget *wid
 void              gepub_widget_set_lineheight                  (GepubWidget *widget,
                                                                 gfloat       size);
 
+void              gepub_widget_get_memory_stats                (GepubWidget      *widget,
+                                                                GepubMemoryStats *stats);
+
 G_END_DECLS
 
 #endif /* __GEPUB_WIDGET_H__ */
@@ -4,6 +4,10 @@
 #include "gepub-archive.h"
 #include "gepub-text-chunk.h"
 #include "gepub-doc.h"
+#include "gepub-doc-cache.h"
+#include "gepub-cursor.h"
+#include "gepub-library-scanner.h"
+#include "gepub-trace.h"
 #include "gepub-widget.h"
 
 #endif
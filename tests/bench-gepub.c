@@ -0,0 +1,228 @@
+#include <string.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#ifdef HAVE_MALLINFO2
+#include <malloc.h>
+#endif
+#include <libgepub/gepub.h>
+
+#include "test-utils.h"
+
+/* Runs the main doc paths over a synthetic book, or the given one, and
+ * prints a JSON object per benchmark:
+ *
+ *   bench-gepub [--bench NAME] [--iterations N] [EPUB]
+ */
+
+typedef struct {
+    const gchar *name;
+    guint iterations;
+    gboolean open_doc;          // run gets a doc opened beforehand
+    void (*run) (const gchar *path, GepubDoc *doc);
+} GepubBench;
+
+static void
+bench_open_cold (const gchar *path, GepubDoc *unused)
+{
+    GepubDoc *doc = gepub_doc_new (path, NULL);
+
+    g_clear_object (&doc);
+}
+
+static void
+bench_open_warm (const gchar *path, GepubDoc *unused)
+{
+    GepubDoc *doc = gepub_doc_new_with_flags (path, GEPUB_DOC_OPEN_INDEX_CACHE, NULL);
+
+    g_clear_object (&doc);
+}
+
+static void
+bench_read_resources (const gchar *path, GepubDoc *doc)
+{
+    GHashTableIter iter;
+    gpointer value;
+
+    g_hash_table_iter_init (&iter, gepub_doc_get_resources (doc));
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        GepubResource *res = value;
+        GBytes *bytes = gepub_doc_get_resource (doc, res->uri);
+
+        if (bytes)
+            g_bytes_unref (bytes);
+    }
+}
+
+static void
+bench_resource_mime (const gchar *path, GepubDoc *doc)
+{
+    GHashTableIter iter;
+    gpointer value;
+
+    g_hash_table_iter_init (&iter, gepub_doc_get_resources (doc));
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        GepubResource *res = value;
+
+        g_free (gepub_doc_get_resource_mime (doc, res->uri));
+    }
+}
+
+static void
+bench_chapter_navigation (const gchar *path, GepubDoc *doc)
+{
+    gepub_doc_set_chapter (doc, 0);
+    do {
+        GBytes *chapter = gepub_doc_get_current_with_epub_uris (doc);
+
+        if (chapter)
+            g_bytes_unref (chapter);
+    } while (gepub_doc_go_next (doc));
+}
+
+static void
+bench_metadata (const gchar *path, GepubDoc *doc)
+{
+    static const gchar *keys[] = {
+        GEPUB_META_TITLE, GEPUB_META_AUTHOR, GEPUB_META_LANG,
+        GEPUB_META_ID, GEPUB_META_DESC, NULL
+    };
+    guint i;
+
+    for (i = 0; keys[i]; i++)
+        g_free (gepub_doc_get_metadata (doc, keys[i]));
+}
+
+static const GepubBench benchmarks[] = {
+    { "open-cold", 20, FALSE, bench_open_cold },
+    { "open-warm", 20, FALSE, bench_open_warm },
+    { "read-resources", 10, TRUE, bench_read_resources },
+    { "resource-mime", 1000, TRUE, bench_resource_mime },
+    { "chapter-navigation", 5, TRUE, bench_chapter_navigation },
+    { "metadata", 100000, TRUE, bench_metadata },
+};
+
+// bytes in use in the malloc heap, -1 if it can't be known
+static gint64
+heap_in_use (void)
+{
+#ifdef HAVE_MALLINFO2
+    struct mallinfo2 info = mallinfo2 ();
+
+    return info.uordblks + info.hblkhd;
+#else
+    return -1;
+#endif
+}
+
+static gboolean
+run_bench (const GepubBench *bench,
+           const gchar      *path,
+           guint             iterations)
+{
+    GepubDoc *doc = NULL;
+    struct rusage usage;
+    gint64 heap_before, heap_after, begin, elapsed;
+    guint i;
+
+    if (bench->open_doc) {
+        doc = gepub_doc_new (path, NULL);
+        if (!doc) {
+            g_printerr ("Can't open %s\n", path);
+            return FALSE;
+        }
+    }
+
+    // untimed, fills the caches the warm runs rely on
+    bench->run (path, doc);
+
+    heap_before = heap_in_use ();
+    begin = g_get_monotonic_time ();
+    for (i = 0; i < iterations; i++)
+        bench->run (path, doc);
+    elapsed = g_get_monotonic_time () - begin;
+    heap_after = heap_in_use ();
+
+    getrusage (RUSAGE_SELF, &usage);
+
+    printf ("{\"benchmark\": \"%s\", \"iterations\": %u, \"total_us\": %" G_GINT64_FORMAT
+            ", \"mean_us\": %.3f, ",
+            bench->name, iterations, elapsed, (gdouble) elapsed / iterations);
+    if (heap_before >= 0)
+        printf ("\"heap_retained_bytes\": %" G_GINT64_FORMAT ", ", heap_after - heap_before);
+    else
+        printf ("\"heap_retained_bytes\": null, ");
+    printf ("\"peak_rss_kib\": %ld}\n", usage.ru_maxrss);
+    fflush (stdout);
+
+    g_clear_object (&doc);
+
+    return TRUE;
+}
+
+int
+main (int argc, char **argv)
+{
+    g_autofree gchar *bench_name = NULL;
+    g_autofree gchar *tmpdir = NULL;
+    g_autofree gchar *cache = NULL;
+    g_autofree gchar *path = NULL;
+    gint iterations = 0;
+    GError *error = NULL;
+    GOptionContext *context;
+    gboolean ok = TRUE, found = FALSE;
+    guint i;
+    GOptionEntry entries[] = {
+        { "bench", 'b', 0, G_OPTION_ARG_STRING, &bench_name, "Only run this benchmark", "NAME" },
+        { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations, "Iterations per benchmark", "N" },
+        { NULL }
+    };
+
+    context = g_option_context_new ("[EPUB]");
+    g_option_context_add_main_entries (context, entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        g_printerr ("%s\n", error->message);
+        g_error_free (error);
+        g_option_context_free (context);
+        return 1;
+    }
+    g_option_context_free (context);
+
+    tmpdir = g_dir_make_tmp ("bench-gepub-XXXXXX", &error);
+    if (!tmpdir) {
+        g_printerr ("%s\n", error->message);
+        g_error_free (error);
+        return 1;
+    }
+
+    // keep the index cache of the warm opens out of the user cache
+    cache = g_build_filename (tmpdir, "cache", NULL);
+    g_setenv ("XDG_CACHE_HOME", cache, TRUE);
+
+    if (argc > 1) {
+        path = g_strdup (argv[1]);
+    } else {
+        path = g_build_filename (tmpdir, "synthetic.epub", NULL);
+        if (!write_synthetic_epub (path)) {
+            g_printerr ("Can't write %s\n", path);
+            remove_tree (tmpdir);
+            return 1;
+        }
+    }
+
+    for (i = 0; i < G_N_ELEMENTS (benchmarks) && ok; i++) {
+        if (bench_name && g_strcmp0 (bench_name, benchmarks[i].name) != 0)
+            continue;
+        found = TRUE;
+        ok = run_bench (&benchmarks[i], path,
+                        iterations > 0 ? (guint) iterations : benchmarks[i].iterations);
+    }
+
+    remove_tree (tmpdir);
+
+    if (!found) {
+        g_printerr ("No benchmark named %s\n", bench_name);
+        return 1;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,308 @@
+#include <libgepub/gepub.h>
+
+#include "test-utils.h"
+
+/* Checks the doc, cursor, cache, trace and memory APIs on a synthetic
+ * book, without a display, so it runs with meson test.
+ */
+
+static gchar *tmpdir;
+static gchar *book;
+
+static guint64
+stage_calls (GepubTraceStage stage)
+{
+    GepubTraceCounters counters;
+
+    gepub_trace_get_counters (stage, &counters);
+
+    return counters.calls;
+}
+
+static void
+test_doc_cursors (void)
+{
+    GepubDoc *doc = gepub_doc_new (book, NULL);
+    GepubCursor *a, *b;
+
+    g_assert_nonnull (doc);
+
+    // two readers of the same doc
+    a = gepub_cursor_new (doc);
+    b = gepub_cursor_new (doc);
+
+    g_assert_true (gepub_cursor_go_next (a));
+    g_assert_true (gepub_cursor_go_next (a));
+    g_assert_true (gepub_cursor_go_next (b));
+
+    // they don't move the doc or each other
+    g_assert_cmpint (gepub_doc_get_chapter (doc), ==, 0);
+    g_assert_cmpint (gepub_cursor_get_chapter (a), ==, 2);
+    g_assert_cmpint (gepub_cursor_get_chapter (b), ==, 1);
+    g_assert_cmpstr (gepub_cursor_get_current_id (a), ==, "ch2");
+    g_assert_cmpstr (gepub_cursor_get_current_id (b), ==, "ch1");
+
+    g_object_unref (a);
+    g_object_unref (b);
+    g_object_unref (doc);
+}
+
+static void
+test_doc_cache (void)
+{
+    gsize budget = gepub_doc_cache_get_budget ();
+    GepubDoc *a, *b;
+
+    a = gepub_doc_cache_get (book, NULL);
+    b = gepub_doc_cache_get (book, NULL);
+    g_assert_nonnull (a);
+    g_assert_true (a == b);
+    g_object_unref (b);
+
+    // with no budget, the doc goes away with its last user
+    gepub_doc_cache_set_budget (0);
+    g_object_add_weak_pointer (G_OBJECT (a), (gpointer *) &a);
+    g_object_unref (a);
+    g_assert_null (a);
+
+    gepub_doc_cache_set_budget (budget);
+    gepub_doc_cache_clear ();
+}
+
+static void
+count_stage (GepubTraceStage  stage,
+             const gchar     *path,
+             gsize            in_size,
+             gsize            out_size,
+             gint64           begin_time,
+             gint64           duration,
+             gpointer         user_data)
+{
+    guint *calls = user_data;
+
+    g_atomic_int_inc (calls);
+}
+
+static void
+test_trace_counters (void)
+{
+    GepubDoc *doc;
+    guint calls = 0;
+
+    gepub_trace_reset_counters ();
+    gepub_trace_set_func (count_stage, &calls, NULL);
+    doc = gepub_doc_new (book, NULL);
+    g_assert_nonnull (doc);
+    g_list_free_full (gepub_doc_get_text (doc), g_object_unref);
+
+    g_assert_cmpuint (stage_calls (GEPUB_TRACE_ARCHIVE_OPEN), >, 0);
+    g_assert_cmpuint (stage_calls (GEPUB_TRACE_PACKAGE_PARSE), ==, 1);
+    g_assert_cmpuint (stage_calls (GEPUB_TRACE_ENTRY_READ), >, 0);
+    g_assert_cmpuint (stage_calls (GEPUB_TRACE_TEXT_EXTRACT), ==, 1);
+    g_assert_cmpuint (calls, >, 0);
+
+    // the func isn't called anymore once it's unset
+    gepub_trace_set_func (NULL, NULL, NULL);
+    calls = 0;
+    g_list_free_full (gepub_doc_get_text (doc), g_object_unref);
+    g_assert_cmpuint (calls, ==, 0);
+    g_assert_cmpuint (stage_calls (GEPUB_TRACE_TEXT_EXTRACT), ==, 2);
+
+    g_object_unref (doc);
+}
+
+static void
+test_doc_memory_stats (void)
+{
+    GepubDoc *doc = gepub_doc_new (book, NULL);
+    GepubMemoryStats stats;
+
+    g_assert_nonnull (doc);
+
+    // measuring doesn't build the TOC
+    gepub_trace_reset_counters ();
+    gepub_doc_get_memory_stats (doc, &stats);
+    g_assert_cmpuint (stage_calls (GEPUB_TRACE_TOC_PARSE), ==, 0);
+    g_assert_cmpuint (stats.toc, ==, 0);
+    g_assert_cmpuint (stats.n_toc_entries, ==, 0);
+    g_assert_cmpuint (stats.n_chapters, ==, N_CHAPTERS);
+    // the chapters, the images, the nav, the NCX and the stylesheet
+    g_assert_cmpuint (stats.n_resources, ==, N_CHAPTERS + 23);
+    g_assert_cmpuint (stats.total, >=, stats.package + stats.strings + stats.resources +
+                                       stats.spine + stats.archive_index);
+
+    g_assert_nonnull (gepub_doc_get_toc (doc));
+    gepub_doc_get_memory_stats (doc, &stats);
+    g_assert_cmpuint (stats.n_toc_entries, ==, N_CHAPTERS);
+    g_assert_cmpuint (stats.toc, >, 0);
+
+    g_object_unref (doc);
+}
+
+// opens with the index cache, counting the package parses it took
+static GepubDoc *
+open_index_cached (const gchar *path, guint64 *parses)
+{
+    GepubDoc *doc;
+
+    gepub_trace_reset_counters ();
+    doc = gepub_doc_new_with_flags (path, GEPUB_DOC_OPEN_INDEX_CACHE, NULL);
+    *parses = stage_calls (GEPUB_TRACE_PACKAGE_PARSE);
+
+    return doc;
+}
+
+static void
+assert_same_doc (GepubDoc *a, GepubDoc *b)
+{
+    g_autofree gchar *title_a = gepub_doc_get_metadata (a, GEPUB_META_TITLE);
+    g_autofree gchar *title_b = gepub_doc_get_metadata (b, GEPUB_META_TITLE);
+    const GepubTocEntry *toc_a, *toc_b;
+    guint n_a, n_b, i;
+    GList *la, *lb, *l, *m;
+
+    g_assert_cmpstr (title_a, ==, title_b);
+    g_assert_cmpint (gepub_doc_get_n_chapters (a), ==, gepub_doc_get_n_chapters (b));
+
+    // the manifest order is kept
+    la = gepub_doc_get_resources_by_mime (a, "image/png");
+    lb = gepub_doc_get_resources_by_mime (b, "image/png");
+    g_assert_cmpuint (g_list_length (la), ==, g_list_length (lb));
+    for (l = la, m = lb; l && m; l = l->next, m = m->next)
+        g_assert_cmpstr (l->data, ==, m->data);
+    g_list_free (la);
+    g_list_free (lb);
+
+    toc_a = gepub_doc_get_toc_entries (a, &n_a);
+    toc_b = gepub_doc_get_toc_entries (b, &n_b);
+    g_assert_cmpuint (n_a, ==, n_b);
+    for (i = 0; i < n_a; i++) {
+        g_assert_cmpstr (toc_a[i].label, ==, toc_b[i].label);
+        g_assert_cmpstr (toc_a[i].content, ==, toc_b[i].content);
+        g_assert_cmpint (toc_a[i].depth, ==, toc_b[i].depth);
+        g_assert_cmpint (toc_a[i].parent, ==, toc_b[i].parent);
+        g_assert_cmpint (toc_a[i].chapter, ==, toc_b[i].chapter);
+    }
+}
+
+static void
+test_doc_index_cache (void)
+{
+    g_autofree gchar *copy = g_build_filename (tmpdir, "index-cache.epub", NULL);
+    GepubDoc *cold, *warm, *stale;
+    GFile *src, *dst;
+    GFileInfo *info;
+    guint64 parses, mtime;
+
+    // work on a copy, its mtime is changed below
+    src = g_file_new_for_path (book);
+    dst = g_file_new_for_path (copy);
+    g_assert_true (g_file_copy (src, dst, G_FILE_COPY_OVERWRITE, NULL, NULL, NULL, NULL));
+
+    // the first open parses the package and writes the cache
+    cold = open_index_cached (copy, &parses);
+    g_assert_nonnull (cold);
+    g_assert_cmpuint (parses, >, 0);
+
+    // the second one restores it, TOC included, without parsing
+    warm = open_index_cached (copy, &parses);
+    g_assert_nonnull (warm);
+    g_assert_cmpuint (parses, ==, 0);
+    assert_same_doc (cold, warm);
+    g_assert_cmpuint (stage_calls (GEPUB_TRACE_TOC_PARSE), ==, 0);
+
+    // touching the file invalidates the cache
+    info = g_file_query_info (dst, G_FILE_ATTRIBUTE_TIME_MODIFIED,
+                              G_FILE_QUERY_INFO_NONE, NULL, NULL);
+    g_assert_nonnull (info);
+    mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+    g_assert_true (g_file_set_attribute_uint64 (dst, G_FILE_ATTRIBUTE_TIME_MODIFIED, mtime - 60,
+                                                G_FILE_QUERY_INFO_NONE, NULL, NULL));
+
+    stale = open_index_cached (copy, &parses);
+    g_assert_nonnull (stale);
+    g_assert_cmpuint (parses, >, 0);
+    assert_same_doc (cold, stale);
+
+    g_object_unref (info);
+    g_object_unref (cold);
+    g_object_unref (warm);
+    g_object_unref (stale);
+    g_object_unref (src);
+    g_object_unref (dst);
+}
+
+static void
+test_doc_readahead (void)
+{
+    GepubDoc *doc = gepub_doc_new (book, NULL);
+    GepubDoc *plain = gepub_doc_new (book, NULL);
+    GepubMemoryStats stats;
+    GBytes *a, *b, *expected;
+    gint64 deadline;
+
+    g_assert_nonnull (doc);
+    g_assert_nonnull (plain);
+
+    // the worker prepares the next chapter meanwhile
+    gepub_doc_set_readahead (doc, 2, 1);
+    deadline = g_get_monotonic_time () + 10 * G_USEC_PER_SEC;
+    do {
+        g_usleep (10000);
+        gepub_doc_get_memory_stats (doc, &stats);
+    } while (!stats.readahead && g_get_monotonic_time () < deadline);
+    g_assert_cmpuint (stats.readahead, >, 0);
+
+    g_assert_true (gepub_doc_go_next (doc));
+    g_assert_true (gepub_doc_go_next (plain));
+
+    // served twice from the prepared copy, rewritten like it's done
+    // without the read-ahead
+    a = gepub_doc_get_current_with_epub_uris (doc);
+    b = gepub_doc_get_current_with_epub_uris (doc);
+    expected = gepub_doc_get_current_with_epub_uris (plain);
+    g_assert_true (a == b);
+    g_assert_true (g_bytes_equal (a, expected));
+
+    g_bytes_unref (a);
+    g_bytes_unref (b);
+    g_bytes_unref (expected);
+    g_object_unref (doc);
+    g_object_unref (plain);
+}
+
+int
+main (int argc, char **argv)
+{
+    g_autofree gchar *cache = NULL;
+    gint ret;
+
+    g_test_init (&argc, &argv, NULL);
+
+    tmpdir = g_dir_make_tmp ("test-doc-XXXXXX", NULL);
+    g_assert_nonnull (tmpdir);
+
+    // keep the index cache out of the user cache, before anything asks
+    // glib for the cache dir
+    cache = g_build_filename (tmpdir, "cache", NULL);
+    g_setenv ("XDG_CACHE_HOME", cache, TRUE);
+
+    book = g_build_filename (tmpdir, "synthetic.epub", NULL);
+    g_assert_true (write_synthetic_epub (book));
+
+    g_test_add_func ("/doc/cursors", test_doc_cursors);
+    g_test_add_func ("/doc/cache", test_doc_cache);
+    g_test_add_func ("/doc/trace-counters", test_trace_counters);
+    g_test_add_func ("/doc/memory-stats", test_doc_memory_stats);
+    g_test_add_func ("/doc/index-cache", test_doc_index_cache);
+    // last, its worker can still be winding down afterwards
+    g_test_add_func ("/doc/readahead", test_doc_readahead);
+
+    ret = g_test_run ();
+
+    remove_tree (tmpdir);
+    g_free (tmpdir);
+    g_free (book);
+
+    return ret;
+}
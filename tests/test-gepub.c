@@ -216,6 +216,8 @@ test_doc_name (const char *path)
     gchar *description = gepub_doc_get_metadata (doc, GEPUB_META_DESC);
     gchar *cover = gepub_doc_get_cover (doc);
     gchar *cover_mime = NULL;
+    gchar **creators;
+    gint i;
 
     if (cover)
         cover_mime = gepub_doc_get_resource_mime_by_id (doc, cover);
@@ -230,6 +232,10 @@ test_doc_name (const char *path)
     if (cover_mime)
         PTEST ("cover mime: %s\n", cover_mime);
 
+    creators = g_hash_table_lookup (gepub_doc_get_all_metadata (doc), GEPUB_META_AUTHOR);
+    for (i = 0; creators && creators[i]; i++)
+        PTEST ("creator %d: %s\n", i, creators[i]);
+
     g_free (title);
     g_free (lang);
     g_free (id);
@@ -250,6 +256,7 @@ test_doc_resources (const char *path)
 {
     GepubDoc *doc;
     GHashTable *ht;
+    GList *images;
     GBytes *ncx;
     const guchar *data;
     gsize size;
@@ -258,6 +265,10 @@ test_doc_resources (const char *path)
     ht = (GHashTable*)gepub_doc_get_resources (doc);
     g_hash_table_foreach (ht, (GHFunc)pk, NULL);
 
+    images = gepub_doc_get_resources_by_mime (doc, "image/*");
+    PTEST ("images: %d\n", g_list_length (images));
+    g_list_free (images);
+
     ncx = gepub_doc_get_resource_by_id (doc, "ncx");
     data = g_bytes_get_data (ncx, &size);
     PTEST ("ncx:\n%.*s\n", size, data);
@@ -295,6 +306,172 @@ test_doc_toc (const char *path)
     g_object_unref (G_OBJECT (doc));
 }
 
+static void
+test_doc_toc_tree (const char *path)
+{
+    GepubDoc *doc = gepub_doc_new (path, NULL);
+    const GepubTocEntry *entries;
+    guint n, i;
+    gint chapter;
+
+    entries = gepub_doc_get_toc_entries (doc, &n);
+    for (i = 0; i < n; i++) {
+        PTEST ("%*s%s -> %s#%s (chapter %d, parent %d)\n", entries[i].depth * 2, "",
+               entries[i].label, entries[i].content,
+               entries[i].fragment ? entries[i].fragment : "",
+               entries[i].chapter, entries[i].parent);
+    }
+
+    for (chapter = 0; chapter < gepub_doc_get_n_chapters (doc); chapter++) {
+        gint entry = gepub_doc_find_toc_entry (doc, chapter, NULL);
+        PTEST ("chapter %d is in: %s\n", chapter, entry >= 0 ? entries[entry].label : "-");
+    }
+
+    g_object_unref (G_OBJECT (doc));
+}
+
+static void
+test_doc_from_bytes (const char *path)
+{
+    GepubDoc *doc;
+    GBytes *bytes;
+    gchar *contents = NULL;
+    gsize size;
+    gchar *title;
+    GError *error = NULL;
+
+    if (!g_file_get_contents (path, &contents, &size, NULL)) {
+        PTEST ("ERROR: can't read %s\n", path);
+        return;
+    }
+
+    bytes = g_bytes_new_take (contents, size);
+    doc = gepub_doc_new_from_bytes (bytes, &error);
+    g_bytes_unref (bytes);
+
+    if (!doc) {
+        PTEST ("ERROR: %s\n", error->message);
+        g_error_free (error);
+        return;
+    }
+
+    title = gepub_doc_get_metadata (doc, GEPUB_META_TITLE);
+    PTEST ("title: %s\n", title);
+    PTEST ("chapters: %d\n", gepub_doc_get_n_chapters (doc));
+
+    g_free (title);
+    g_object_unref (G_OBJECT (doc));
+}
+
+static void
+test_doc_metadata_only (const char *path)
+{
+    GepubDoc *doc;
+    gchar *title, *author, *cover, *cover_path;
+    GError *error = NULL;
+
+    doc = gepub_doc_new_with_flags (path, GEPUB_DOC_OPEN_METADATA_ONLY, &error);
+    if (!doc) {
+        PTEST ("ERROR: %s\n", error->message);
+        g_error_free (error);
+        return;
+    }
+
+    title = gepub_doc_get_metadata (doc, GEPUB_META_TITLE);
+    author = gepub_doc_get_metadata (doc, GEPUB_META_AUTHOR);
+    cover = gepub_doc_get_cover (doc);
+    cover_path = cover ? gepub_doc_get_resource_path (doc, cover) : NULL;
+    PTEST ("title: %s\nauthor: %s\ncover: %s\n", title, author, cover_path);
+    PTEST ("resources: %d\n", g_hash_table_size (gepub_doc_get_resources (doc)));
+
+    g_free (title);
+    g_free (author);
+    g_free (cover);
+    g_free (cover_path);
+    g_object_unref (doc);
+}
+
+static void
+doc_opened_cb (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+    GMainLoop *loop = user_data;
+    GepubDoc *doc;
+    gchar *title;
+    GError *error = NULL;
+
+    doc = gepub_doc_new_finish (result, &error);
+    if (!doc) {
+        PTEST ("ERROR: %s\n", error->message);
+        g_error_free (error);
+    } else {
+        title = gepub_doc_get_metadata (doc, GEPUB_META_TITLE);
+        PTEST ("title: %s, chapters: %d\n", title, gepub_doc_get_n_chapters (doc));
+        g_free (title);
+        g_object_unref (doc);
+    }
+
+    g_main_loop_quit (loop);
+}
+
+static void
+test_doc_async (const char *path)
+{
+    GMainLoop *loop = g_main_loop_new (NULL, FALSE);
+
+    gepub_doc_new_async (path, NULL, doc_opened_cb, loop);
+    g_main_loop_run (loop);
+
+    g_main_loop_unref (loop);
+}
+
+static void
+book_scanned_cb (GepubLibraryScanner *scanner,
+                 const gchar         *path,
+                 GepubDoc            *doc,
+                 GError              *error,
+                 gpointer             user_data)
+{
+    gchar *title;
+
+    if (!doc) {
+        PTEST ("%s: ERROR: %s\n", path, error->message);
+        return;
+    }
+
+    title = gepub_doc_get_metadata (doc, GEPUB_META_TITLE);
+    PTEST ("%s: %s, chapters: %d\n", path, title, gepub_doc_get_n_chapters (doc));
+    g_free (title);
+}
+
+static void
+scan_done_cb (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+    GMainLoop *loop = user_data;
+    GError *error = NULL;
+
+    if (!gepub_library_scanner_scan_finish (GEPUB_LIBRARY_SCANNER (source), result, &error)) {
+        PTEST ("ERROR: %s\n", error->message);
+        g_error_free (error);
+    }
+
+    g_main_loop_quit (loop);
+}
+
+static void
+test_library_scanner (const char *path)
+{
+    GMainLoop *loop = g_main_loop_new (NULL, FALSE);
+    GepubLibraryScanner *scanner = gepub_library_scanner_new (0);
+    const gchar *paths[] = { path, path, NULL };
+
+    g_signal_connect (scanner, "book-scanned", G_CALLBACK (book_scanned_cb), NULL);
+    gepub_library_scanner_scan_async (scanner, paths, NULL, scan_done_cb, loop);
+    g_main_loop_run (loop);
+
+    g_object_unref (scanner);
+    g_main_loop_unref (loop);
+}
+
 static void
 destroy_cb (GtkWidget *window,
             GtkWidget *view)
@@ -458,6 +635,11 @@ main (int argc, char **argv)
     TEST(test_doc_resources, argv[1])
     TEST(test_doc_spine, argv[1])
     TEST(test_doc_toc, argv[1])
+    TEST(test_doc_toc_tree, argv[1])
+    TEST(test_doc_from_bytes, argv[1])
+    TEST(test_doc_async, argv[1])
+    TEST(test_doc_metadata_only, argv[1])
+    TEST(test_library_scanner, argv[1])
 
     // Freeing the mallocs :P
     if (buf2) {
@@ -0,0 +1,177 @@
+#include <string.h>
+#include <archive.h>
+#include <archive_entry.h>
+#include <glib/gstdio.h>
+
+#include "test-utils.h"
+
+/* The synthetic book: a nav document and an NCX with an entry per
+ * chapter, a stylesheet, and chapters with an image and many linked
+ * paragraphs each.
+ */
+#define N_IMAGES     20
+#define N_PARAGRAPHS 40
+#define IMAGE_SIZE   (32 * 1024)
+
+static const gchar *lorem =
+    "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod "
+    "tempor incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam, "
+    "quis nostrud exercitation ullamco laboris nisi ut aliquip ex ea commodo consequat.";
+
+static void
+epub_add (struct archive *a, const gchar *name, const gchar *data, gsize size)
+{
+    struct archive_entry *entry = archive_entry_new ();
+
+    archive_entry_set_pathname (entry, name);
+    archive_entry_set_filetype (entry, AE_IFREG);
+    archive_entry_set_perm (entry, 0644);
+    archive_entry_set_size (entry, size);
+    archive_write_header (a, entry);
+    archive_write_data (a, data, size);
+    archive_entry_free (entry);
+}
+
+static void
+epub_add_string (struct archive *a, const gchar *name, GString *str)
+{
+    epub_add (a, name, str->str, str->len);
+    g_string_truncate (str, 0);
+}
+
+gboolean
+write_synthetic_epub (const gchar *path)
+{
+    struct archive *a;
+    GString *str;
+    GRand *rand;
+    guchar *image;
+    gint i, j;
+
+    a = archive_write_new ();
+    archive_write_set_format_zip (a);
+    if (archive_write_open_filename (a, path) != ARCHIVE_OK) {
+        archive_write_free (a);
+        return FALSE;
+    }
+
+    str = g_string_new (NULL);
+    rand = g_rand_new_with_seed (42);
+
+    // the mimetype goes first and stored, as the OCF requires
+    archive_write_zip_set_compression_store (a);
+    epub_add (a, "mimetype", "application/epub+zip", strlen ("application/epub+zip"));
+    archive_write_zip_set_compression_deflate (a);
+
+    g_string_append (str,
+        "<?xml version=\"1.0\"?>\n"
+        "<container version=\"1.0\" xmlns=\"urn:oasis:names:tc:opendocument:xmlns:container\">\n"
+        "  <rootfiles>\n"
+        "    <rootfile full-path=\"OEBPS/content.opf\" media-type=\"application/oebps-package+xml\"/>\n"
+        "  </rootfiles>\n"
+        "</container>\n");
+    epub_add_string (a, "META-INF/container.xml", str);
+
+    g_string_append (str,
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<package xmlns=\"http://www.idpf.org/2007/opf\" version=\"3.0\" unique-identifier=\"id\">\n"
+        "  <metadata xmlns:dc=\"http://purl.org/dc/elements/1.1/\">\n"
+        "    <dc:identifier id=\"id\">urn:uuid:00000000-0000-0000-0000-000000000000</dc:identifier>\n"
+        "    <dc:title>Synthetic benchmark book</dc:title>\n"
+        "    <dc:creator>libgepub</dc:creator>\n"
+        "    <dc:language>en</dc:language>\n"
+        "    <dc:description>A generated book to time libgepub</dc:description>\n"
+        "  </metadata>\n"
+        "  <manifest>\n"
+        "    <item id=\"nav\" href=\"nav.xhtml\" media-type=\"application/xhtml+xml\" properties=\"nav\"/>\n"
+        "    <item id=\"ncx\" href=\"toc.ncx\" media-type=\"application/x-dtbncx+xml\"/>\n"
+        "    <item id=\"css\" href=\"style.css\" media-type=\"text/css\"/>\n");
+    for (i = 0; i < N_IMAGES; i++)
+        g_string_append_printf (str, "    <item id=\"img%d\" href=\"images/img%d.png\" media-type=\"image/png\"/>\n", i, i);
+    for (i = 0; i < N_CHAPTERS; i++)
+        g_string_append_printf (str, "    <item id=\"ch%d\" href=\"text/ch%d.xhtml\" media-type=\"application/xhtml+xml\"/>\n", i, i);
+    g_string_append (str, "  </manifest>\n  <spine toc=\"ncx\">\n");
+    for (i = 0; i < N_CHAPTERS; i++)
+        g_string_append_printf (str, "    <itemref idref=\"ch%d\"/>\n", i);
+    g_string_append (str, "  </spine>\n</package>\n");
+    epub_add_string (a, "OEBPS/content.opf", str);
+
+    g_string_append (str,
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<html xmlns=\"http://www.w3.org/1999/xhtml\" xmlns:epub=\"http://www.idpf.org/2007/ops\">\n"
+        "<head><title>Contents</title></head>\n"
+        "<body><nav epub:type=\"toc\"><ol>\n");
+    for (i = 0; i < N_CHAPTERS; i++)
+        g_string_append_printf (str, "  <li><a href=\"text/ch%d.xhtml\">Chapter %d</a></li>\n", i, i + 1);
+    g_string_append (str, "</ol></nav></body>\n</html>\n");
+    epub_add_string (a, "OEBPS/nav.xhtml", str);
+
+    g_string_append (str,
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<ncx xmlns=\"http://www.daisy.org/z3986/2005/ncx/\" version=\"2005-1\">\n"
+        "<navMap>\n");
+    for (i = 0; i < N_CHAPTERS; i++) {
+        g_string_append_printf (str,
+            "  <navPoint id=\"np%d\" playOrder=\"%d\">"
+            "<navLabel><text>Chapter %d</text></navLabel>"
+            "<content src=\"text/ch%d.xhtml\"/></navPoint>\n", i, i + 1, i + 1, i);
+    }
+    g_string_append (str, "</navMap>\n</ncx>\n");
+    epub_add_string (a, "OEBPS/toc.ncx", str);
+
+    g_string_append (str, "body { margin: 0 5%; }\np { text-indent: 1em; }\nimg { max-width: 100%; }\n");
+    epub_add_string (a, "OEBPS/style.css", str);
+
+    // random data, so the images don't compress, like real ones
+    image = g_malloc (IMAGE_SIZE);
+    for (i = 0; i < N_IMAGES; i++) {
+        g_autofree gchar *name = g_strdup_printf ("OEBPS/images/img%d.png", i);
+
+        for (j = 0; j < IMAGE_SIZE; j++)
+            image[j] = g_rand_int_range (rand, 0, 256);
+        epub_add (a, name, (const gchar *) image, IMAGE_SIZE);
+    }
+    g_free (image);
+
+    for (i = 0; i < N_CHAPTERS; i++) {
+        g_autofree gchar *name = g_strdup_printf ("OEBPS/text/ch%d.xhtml", i);
+
+        g_string_append_printf (str,
+            "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            "<html xmlns=\"http://www.w3.org/1999/xhtml\">\n"
+            "<head><title>Chapter %d</title>"
+            "<link rel=\"stylesheet\" type=\"text/css\" href=\"../style.css\"/></head>\n"
+            "<body>\n<h1>Chapter %d</h1>\n"
+            "<img src=\"../images/img%d.png\" alt=\"\"/>\n", i + 1, i + 1, i % N_IMAGES);
+        for (j = 0; j < N_PARAGRAPHS; j++) {
+            g_string_append_printf (str, "<p>%s <b>%d</b> <i>%s</i> <a href=\"ch%d.xhtml\">next</a></p>\n",
+                                    lorem, j, lorem, (i + 1) % N_CHAPTERS);
+        }
+        g_string_append (str, "</body>\n</html>\n");
+        epub_add_string (a, name, str);
+    }
+
+    archive_write_close (a);
+    archive_write_free (a);
+    g_string_free (str, TRUE);
+    g_rand_free (rand);
+
+    return TRUE;
+}
+
+void
+remove_tree (const gchar *path)
+{
+    GDir *dir = g_dir_open (path, 0, NULL);
+    const gchar *name;
+
+    if (dir) {
+        while ((name = g_dir_read_name (dir))) {
+            g_autofree gchar *child = g_build_filename (path, name, NULL);
+            remove_tree (child);
+        }
+        g_dir_close (dir);
+    }
+
+    g_remove (path);
+}
@@ -0,0 +1,12 @@
+#ifndef __TEST_UTILS_H__
+#define __TEST_UTILS_H__
+
+#include <glib.h>
+
+// the chapters of the book written by write_synthetic_epub()
+#define N_CHAPTERS 200
+
+gboolean write_synthetic_epub (const gchar *path);
+void     remove_tree          (const gchar *path);
+
+#endif